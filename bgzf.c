@@ -429,6 +429,23 @@ ssize_t bgzf_write(BGZF *fp, const void *data, ssize_t length)
 	return bytes_written;
 }
 
+ssize_t bgzf_raw_read(BGZF *fp, void *data, ssize_t length)
+{
+	assert(fp->open_mode == 'r');
+	return _bgzf_read(fp->fp, data, length);
+}
+
+ssize_t bgzf_raw_write(BGZF *fp, const void *data, ssize_t length)
+{
+	assert(fp->open_mode == 'w' && fp->block_offset == 0);
+	if (fwrite(data, 1, length, (FILE*)fp->fp) != (size_t)length) {
+		fp->errcode |= BGZF_ERR_IO;
+		return -1;
+	}
+	fp->block_address += length;
+	return length;
+}
+
 int bgzf_close(BGZF* fp)
 {
 	int ret, count, block_length;
@@ -189,6 +189,22 @@ extern "C" {
 	 */
 	int bgzf_read_block(BGZF *fp);
 
+	/**
+	 * Read _length_ bytes from the underlying file, bypassing decompression.
+	 * Mixing this with bgzf_read() is only meaningful at block boundaries.
+	 *
+	 * @return       number of bytes actually read; 0 on end-of-file and -1 on error
+	 */
+	ssize_t bgzf_raw_read(BGZF *fp, void *data, ssize_t length);
+
+	/**
+	 * Write _length_ bytes of already compressed BGZF blocks to the file. The
+	 * buffer must be flushed with bgzf_flush() before calling this function.
+	 *
+	 * @return       number of bytes actually written; -1 on error
+	 */
+	ssize_t bgzf_raw_write(BGZF *fp, const void *data, ssize_t length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,82 +1,1133 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
 #include "vcf.h"
+#include "vcfexpr.h"
+#include "vcfgtm.h"
+#include "vcfpbwt.h"
+#include "vcfcol.h"
+#include "vcfsti.h"
 
-int main(int argc, char *argv[])
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static int concat_bin(int n, char *const *fn, const char *fn_out, int clevel)
+{
+	int i, ret = 0;
+	char modew[8];
+	vcfFile *out = 0;
+	vcf_hdr_t *h0 = 0;
+	strcpy(modew, "wb");
+	if (clevel >= 0 && clevel <= 9) sprintf(modew + 2, "%d", clevel);
+	for (i = 0; i < n && ret == 0; ++i) {
+		vcfFile *in;
+		vcf_hdr_t *h;
+		if ((in = vcf_open(fn[i], "rb", 0)) == 0) { // vcf_open() reports the error
+			ret = 1;
+			break;
+		}
+		if ((h = vcf_hdr_read(in)) == 0) {
+			fprintf(stderr, "[E::%s] fail to read the header of '%s'\n", __func__, fn[i]);
+			ret = 1;
+		} else if (h0 == 0) {
+			h0 = h;
+			if ((out = vcf_open(fn_out? fn_out : "-", modew, 0)) == 0) ret = 1;
+			else vcf_hdr_write(out, h);
+		} else if (!vcf_hdr_compat(h0, h)) {
+			fprintf(stderr, "[E::%s] the header of '%s' is incompatible with that of '%s'\n", __func__, fn[i], fn[0]);
+			ret = 1;
+		}
+		if (ret == 0 && vcf_concat_raw(out, in) < 0) ret = 1;
+		if (h && h != h0) vcf_hdr_destroy(h);
+		vcf_close(in);
+	}
+	if (out) vcf_close(out);
+	if (h0) vcf_hdr_destroy(h0);
+	return ret;
+}
+
+static char **read_list(const char *str, int *n)
+{
+	FILE *fp;
+	kstring_t s = {0,0,0};
+	char **list = 0;
+	int c, m = 0;
+	*n = 0;
+	if ((fp = fopen(str, "r")) != 0) { // one name per line
+		for (;;) {
+			c = fgetc(fp);
+			if (c == '\n' || c == EOF) {
+				if (s.l) {
+					if (*n == m) m = m? m<<1 : 16, list = (char**)realloc(list, m * sizeof(char*));
+					list[(*n)++] = strdup(s.s);
+				}
+				s.l = 0;
+				if (c == EOF) break;
+			} else if (c != '\r') kputc(c, &s);
+		}
+		fclose(fp);
+	} else { // a comma-separated list
+		const char *p, *q;
+		for (p = q = str;; ++q) {
+			if (*q != ',' && *q != 0) continue;
+			if (q > p) {
+				if (*n == m) m = m? m<<1 : 16, list = (char**)realloc(list, m * sizeof(char*));
+				list[*n] = (char*)calloc(q - p + 1, 1);
+				strncpy(list[(*n)++], p, q - p);
+			}
+			if (*q == 0) break;
+			p = q + 1;
+		}
+	}
+	free(s.s);
+	return list;
+}
+
+static int read1_filtered(vcfFile *fp, const vcf_hdr_t *h, vcf1_t *v, vcf_expr_t *e, int is_excl)
+{
+	int ret;
+	while ((ret = vcf_read1(fp, h, v)) >= 0)
+		if (e == 0 || vcf_expr_eval(e, v) != is_excl) break;
+	return ret;
+}
+
+/*****************
+ * Lookups by ID *
+ *****************/
+
+typedef struct {
+	int n;
+	char **list; // sorted
+	int64_t i, n_off, *off; // virtual offsets from the ID index; scan the file if off is NULL
+	kstring_t str;
+} idq_t;
+
+static int idq_strcmp(const void *a, const void *b)
+{
+	return strcmp(*(char*const*)a, *(char*const*)b);
+}
+
+static int int64_cmp(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static idq_t *idq_init(const char *fn, const char *ids) // fn: BCF whose ID index is used if present
+{
+	idq_t *q;
+	vcf_ids_t *x;
+	q = (idq_t*)calloc(1, sizeof(idq_t));
+	q->list = read_list(ids, &q->n);
+	qsort(q->list, q->n, sizeof(char*), idq_strcmp);
+	if (fn && (x = vcf_ids_load(fn)) != 0) { // collect the candidate records; reading them in order also drops duplicates
+		int i, k, n, m_voff = 0;
+		int64_t *voff = 0, m_off = 0;
+		for (i = 0; i < q->n; ++i) {
+			n = vcf_ids_get(x, q->list[i], &voff, &m_voff);
+			if (q->n_off + n > m_off) {
+				m_off = q->n_off + n > m_off<<1? q->n_off + n : m_off<<1;
+				q->off = (int64_t*)realloc(q->off, m_off * 8);
+			}
+			for (k = 0; k < n; ++k) q->off[q->n_off++] = voff[k];
+		}
+		if (q->off == 0) q->off = (int64_t*)malloc(8); // no hits, but do not scan
+		qsort(q->off, q->n_off, 8, int64_cmp);
+		for (i = k = 0; i < q->n_off; ++i)
+			if (k == 0 || q->off[i] != q->off[k-1]) q->off[k++] = q->off[i];
+		q->n_off = k;
+		free(voff);
+		vcf_ids_destroy(x);
+	}
+	return q;
+}
+
+static void idq_destroy(idq_t *q)
+{
+	int i;
+	for (i = 0; i < q->n; ++i) free(q->list[i]);
+	free(q->list); free(q->off); free(q->str.s);
+	free(q);
+}
+
+static int idq_match(idq_t *q, const vcf1_t *v) // whether an ID of _v_ is in the list
+{
+	char *p, *r, *s;
+	q->str.l = 0;
+	vcf_fmt_sized_array(&q->str, (uint8_t*)v->shared.s);
+	for (p = q->str.s; p && p < q->str.s + q->str.l; p = r? r + 1 : 0) {
+		if ((r = strchr(p, ';')) != 0) *r = 0;
+		s = p;
+		if (bsearch(&s, q->list, q->n, sizeof(char*), idq_strcmp)) return 1;
+	}
+	return 0;
+}
+
+static int idq_read1(idq_t *q, vcfFile *fp, const vcf_hdr_t *h, vcf1_t *v, vcf_expr_t *e, int is_excl)
+{
+	if (q->off == 0) {
+		while (read1_filtered(fp, h, v, e, is_excl) >= 0)
+			if (idq_match(q, v)) return 0;
+		return -1;
+	}
+	while (q->i < q->n_off) {
+		if (vcf_seek(fp, q->off[q->i++]) < 0 || vcf_read1(fp, h, v) < 0) return -1;
+		if (idq_match(q, v) && (e == 0 || vcf_expr_eval(e, v) != is_excl)) return 0;
+	}
+	return -1;
+}
+
+/*************************
+ * Per-sample statistics *
+ *************************/
+
+#define SS_HOM_REF 0
+#define SS_HET     1
+#define SS_HOM_ALT 2
+#define SS_MISSING 3
+
+typedef struct {
+	int n, n_rec, m_fmt, m_gt, m_dp, m_ac; // n_rec: records since c16[] was flushed
+	uint16_t *c16[4]; // genotype class counts; flushed to cnt[] before they overflow
+	int64_t *cnt[4], *dp_sum, *dp_n, *n_single;
+	int32_t *gt, *dp, *ac;
+	vcf_fmt_t *fmt;
+} sstat_t;
+
+static sstat_t *sstat_init(int n)
+{
+	sstat_t *s;
+	int k;
+	s = (sstat_t*)calloc(1, sizeof(sstat_t));
+	s->n = n;
+	for (k = 0; k < 4; ++k) {
+		s->c16[k] = (uint16_t*)calloc(n + 1, 2);
+		s->cnt[k] = (int64_t*)calloc(n + 1, 8);
+	}
+	s->dp_sum = (int64_t*)calloc(n + 1, 8);
+	s->dp_n = (int64_t*)calloc(n + 1, 8);
+	s->n_single = (int64_t*)calloc(n + 1, 8);
+	return s;
+}
+
+static void sstat_flush(sstat_t *s)
+{
+	int i, k;
+	for (k = 0; k < 4; ++k)
+		for (i = 0; i < s->n; ++i)
+			s->cnt[k][i] += s->c16[k][i], s->c16[k][i] = 0;
+	s->n_rec = 0;
+}
+
+static inline int gt_class(const int32_t *x, int w)
 {
-	int task = 0; // 0 for conversion, 1 for counting and 2 for site frequency
-	int c, clevel = -1, flag = 0;
-	char *fn_ref = 0, *fn_out = 0, moder[8];
+	int j, a0 = -1, is_het = 0;
+	for (j = 0; j < w && x[j] != INT32_MIN; ++j) {
+		int a = (x[j] >> 1) - 1;
+		if (a < 0) return SS_MISSING;
+		if (j == 0) a0 = a;
+		else if (a != a0) is_het = 1;
+	}
+	if (a0 < 0) return SS_MISSING;
+	return is_het? SS_HET : a0 == 0? SS_HOM_REF : SS_HOM_ALT;
+}
+
+static void sstat_gt_diploid8(sstat_t *s, const int8_t *p) // the fast path for int8 diploid GT
+{
+	int i = 0, j;
+#ifdef __SSE2__
+	__m128i lo = _mm_set1_epi16(0xfe), ref = _mm_set1_epi16(2), pad = _mm_set1_epi16(0x80), zero = _mm_setzero_si128();
+	for (; i + 8 <= s->n; i += 8) { // 8 samples per iteration, one in each 16-bit lane
+		__m128i x = _mm_loadu_si128((const __m128i*)(p + i * 2));
+		__m128i a = _mm_and_si128(x, lo), b = _mm_and_si128(_mm_srli_epi16(x, 8), lo), miss, is_ref, same, y;
+		miss = _mm_or_si128(_mm_cmpeq_epi16(a, zero), _mm_cmpeq_epi16(b, zero));
+		if (_mm_movemask_epi8(_mm_andnot_si128(miss, _mm_cmpeq_epi16(b, pad)))) break; // a haploid call; use the scalar code
+		is_ref = _mm_and_si128(_mm_cmpeq_epi16(a, ref), _mm_cmpeq_epi16(b, ref));
+		same = _mm_cmpeq_epi16(a, b);
+#define ss_add(k, m) (y = _mm_loadu_si128((__m128i*)(s->c16[k] + i)), _mm_storeu_si128((__m128i*)(s->c16[k] + i), _mm_sub_epi16(y, (m))))
+		ss_add(SS_HOM_REF, is_ref);
+		ss_add(SS_HET, _mm_andnot_si128(_mm_or_si128(miss, same), _mm_cmpeq_epi16(zero, zero)));
+		ss_add(SS_HOM_ALT, _mm_andnot_si128(_mm_or_si128(miss, is_ref), same));
+		ss_add(SS_MISSING, miss);
+#undef ss_add
+	}
+#endif
+	for (; i < s->n; ++i) {
+		int32_t x[2];
+		for (j = 0; j < 2; ++j) x[j] = p[i*2+j] == INT8_MIN? INT32_MIN : p[i*2+j];
+		++s->c16[gt_class(x, 2)][i];
+	}
+}
+
+static void sstat_add(sstat_t *s, const vcf_hdr_t *h, vcf1_t *v)
+{
+	int i, j, k, w, n, an, gt_id;
+	if (v->n_sample != s->n) return;
+	if ((int)v->n_fmt > s->m_fmt) {
+		s->m_fmt = v->n_fmt;
+		s->fmt = (vcf_fmt_t*)realloc(s->fmt, s->m_fmt * sizeof(vcf_fmt_t));
+	}
+	vcf_unpack_fmt_core((uint8_t*)v->indiv.s, v->n_sample, v->n_fmt, s->fmt);
+	gt_id = vcf_id2int(h, VCF_DT_ID, "GT");
+	for (k = 0; k < (int)v->n_fmt; ++k)
+		if (s->fmt[k].id == gt_id) break;
+	if (k == (int)v->n_fmt) return; // no GT
+	// genotype classes
+	if (s->fmt[k].type == VCF_BT_INT8 && s->fmt[k].n == 2) sstat_gt_diploid8(s, (int8_t*)s->fmt[k].p);
+	else if ((n = vcf_get_format_int32(h, v, "GT", &s->gt, &s->m_gt)) > 0) {
+		w = n / s->n;
+		for (i = 0; i < s->n; ++i)
+			++s->c16[gt_class(s->gt + i * w, w)][i];
+	}
+	if (++s->n_rec == 0xffff) sstat_flush(s);
+	// singletons
+	if ((an = vcf_count_alleles(h, v, &s->ac, &s->m_ac)) > 0) {
+		for (j = 1; j < v->n_allele; ++j)
+			if (s->ac[j] == 1) break;
+		if (j < v->n_allele && (n = vcf_get_format_int32(h, v, "GT", &s->gt, &s->m_gt)) > 0) {
+			w = n / s->n;
+			for (i = 0; i < s->n; ++i) { // count sites, not alleles, per sample
+				for (k = 0; k < w && s->gt[i*w+k] != INT32_MIN; ++k) {
+					int a = (s->gt[i*w+k] >> 1) - 1;
+					if (a > 0 && a < v->n_allele && s->ac[a] == 1) break;
+				}
+				if (k < w && s->gt[i*w+k] != INT32_MIN) ++s->n_single[i];
+			}
+		}
+	}
+	// depth
+	if ((n = vcf_get_format_int32(h, v, "DP", &s->dp, &s->m_dp)) > 0) {
+		w = n / s->n, i = 0;
+#ifdef __SSE2__
+		if (w == 1) {
+			__m128i miss = _mm_set1_epi32(INT32_MIN), zero = _mm_setzero_si128(), one = _mm_set1_epi32(1);
+			for (; i + 4 <= s->n; i += 4) { // int64 accumulators; DP is non-negative
+				__m128i x = _mm_loadu_si128((const __m128i*)(s->dp + i)), m = _mm_cmpeq_epi32(x, miss), c;
+				x = _mm_andnot_si128(m, x), c = _mm_andnot_si128(m, one);
+				_mm_storeu_si128((__m128i*)(s->dp_sum + i),     _mm_add_epi64(_mm_loadu_si128((__m128i*)(s->dp_sum + i)),     _mm_unpacklo_epi32(x, zero)));
+				_mm_storeu_si128((__m128i*)(s->dp_sum + i + 2), _mm_add_epi64(_mm_loadu_si128((__m128i*)(s->dp_sum + i + 2)), _mm_unpackhi_epi32(x, zero)));
+				_mm_storeu_si128((__m128i*)(s->dp_n + i),       _mm_add_epi64(_mm_loadu_si128((__m128i*)(s->dp_n + i)),       _mm_unpacklo_epi32(c, zero)));
+				_mm_storeu_si128((__m128i*)(s->dp_n + i + 2),   _mm_add_epi64(_mm_loadu_si128((__m128i*)(s->dp_n + i + 2)),   _mm_unpackhi_epi32(c, zero)));
+			}
+		}
+#endif
+		for (; i < s->n; ++i)
+			if (s->dp[i * w] != INT32_MIN) s->dp_sum[i] += s->dp[i * w], ++s->dp_n[i];
+	}
+}
+
+static void sstat_print(sstat_t *s, const vcf_hdr_t *h)
+{
+	int i;
+	sstat_flush(s);
+	printf("#sample\tn_hom_ref\tn_het\tn_hom_alt\tn_missing\tmean_dp\tn_singleton\n");
+	for (i = 0; i < s->n; ++i) {
+		printf("%s\t%lld\t%lld\t%lld\t%lld\t", h->id[VCF_DT_SAMPLE][i].key, (long long)s->cnt[SS_HOM_REF][i],
+			   (long long)s->cnt[SS_HET][i], (long long)s->cnt[SS_HOM_ALT][i], (long long)s->cnt[SS_MISSING][i]);
+		if (s->dp_n[i]) printf("%.2f", (double)s->dp_sum[i] / s->dp_n[i]);
+		else putchar('.');
+		printf("\t%lld\n", (long long)s->n_single[i]);
+	}
+}
+
+static void sstat_destroy(sstat_t *s)
+{
+	int k;
+	for (k = 0; k < 4; ++k) free(s->c16[k]), free(s->cnt[k]);
+	free(s->dp_sum); free(s->dp_n); free(s->n_single);
+	free(s->gt); free(s->dp); free(s->ac); free(s->fmt);
+	free(s);
+}
+
+/**************************
+ * Linkage disequilibrium *
+ **************************/
+
+/* Each site is stored as three bit planes over samples: het, hom-alt and
+   non-missing. For a pair of sites, the dosage sums over samples called at
+   both are obtained with popcounts, from which r^2 is the squared
+   correlation of dosages and D' is derived from the composite D=cov/2. */
+
+typedef struct {
+	int rid, pos;
+	uint64_t *b; // het, hom-alt and non-missing planes of nw words each
+} ld_site_t;
+
+typedef struct {
+	int n_sample, nw, w, n, k; // w: window size; n: sites in the ring; k: the next slot
+	uint8_t *code;
+	ld_site_t *a;
+} ld_ring_t;
+
+static uint16_t ld_tab[256][3]; // 4 codes to 4-bit het, hom-alt and non-missing masks
+
+static ld_ring_t *ld_init(int n_sample, int w)
+{
+	ld_ring_t *r;
+	int i, j;
+	for (i = 0; i < 256; ++i) {
+		ld_tab[i][0] = ld_tab[i][1] = ld_tab[i][2] = 0;
+		for (j = 0; j < 4; ++j) {
+			int c = i >> j*2 & 3;
+			if (c == 1) ld_tab[i][0] |= 1<<j;
+			if (c == 2) ld_tab[i][1] |= 1<<j;
+			if (c != 3) ld_tab[i][2] |= 1<<j;
+		}
+	}
+	r = (ld_ring_t*)calloc(1, sizeof(ld_ring_t));
+	r->n_sample = n_sample, r->w = w;
+	r->nw = (n_sample + 63) >> 6;
+	r->code = (uint8_t*)malloc(r->nw * 16);
+	r->a = (ld_site_t*)calloc(w, sizeof(ld_site_t));
+	for (i = 0; i < w; ++i) r->a[i].b = (uint64_t*)calloc(r->nw * 3, 8);
+	return r;
+}
+
+static void ld_destroy(ld_ring_t *r)
+{
+	int i;
+	for (i = 0; i < r->w; ++i) free(r->a[i].b);
+	free(r->a); free(r->code); free(r);
+}
+
+static inline int popcount64(uint64_t x)
+{
+#ifdef __POPCNT__
+	return __builtin_popcountll(x);
+#else
+	x = x - (x >> 1 & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + (x >> 2 & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int)(x * 0x0101010101010101ULL >> 56);
+#endif
+}
+
+static void ld_pair(int nw, const uint64_t *x, const uint64_t *y, double *r2, double *dp)
+{
+	const uint64_t *xh = x, *xa = x + nw, *xm = x + nw * 2, *yh = y, *ya = y + nw, *ym = y + nw * 2;
+	int64_t n = 0, sx = 0, sxx = 0, sy = 0, syy = 0, sxy = 0;
+	double cov, vx, vy, p, q, d, dmax;
+	int i;
+	for (i = 0; i < nw; ++i) {
+		uint64_t m = xm[i] & ym[i];
+		int hx = popcount64(xh[i] & m), ax = popcount64(xa[i] & m), hy = popcount64(yh[i] & m), ay = popcount64(ya[i] & m);
+		n += popcount64(m);
+		sx += hx + 2 * ax, sxx += hx + 4 * ax;
+		sy += hy + 2 * ay, syy += hy + 4 * ay;
+		sxy += popcount64(xh[i] & yh[i]) + 2 * (popcount64(xh[i] & ya[i]) + popcount64(xa[i] & yh[i])) + 4 * popcount64(xa[i] & ya[i]);
+	}
+	*r2 = *dp = -1.;
+	if (n == 0) return;
+	cov = (double)sxy / n - (double)sx / n * sy / n;
+	vx = (double)sxx / n - (double)sx / n * sx / n;
+	vy = (double)syy / n - (double)sy / n * sy / n;
+	if (vx <= 0. || vy <= 0.) return; // monomorphic among the shared samples
+	*r2 = cov * cov / (vx * vy);
+	p = (double)sx / (2 * n), q = (double)sy / (2 * n), d = cov / 2.;
+	dmax = d > 0.? (p * (1. - q) < q * (1. - p)? p * (1. - q) : q * (1. - p)) : (p * q < (1. - p) * (1. - q)? p * q : (1. - p) * (1. - q));
+	*dp = dmax > 0.? d / dmax : 0.;
+	if (*dp > 1.) *dp = 1.; // the composite D may exceed Dmax out of HWE
+	else if (*dp < -1.) *dp = -1.;
+}
+
+// add a site to the ring and print its pairs with earlier sites on the same contig
+static void ld_add(ld_ring_t *r, const vcf_hdr_t *h, const vcf1_t *v, double min_r2, kstring_t *str)
+{
+	ld_site_t *s = &r->a[r->k];
+	int i, j;
+	if (v->n_sample != r->n_sample) return;
+	memset(r->code, 0xff, r->nw * 16);
+	vcf_pack_gt2(h, v, r->code);
+	for (i = 0; i < r->nw; ++i) {
+		uint64_t z[3] = {0, 0, 0};
+		for (j = 0; j < 16; ++j) {
+			const uint16_t *t = ld_tab[r->code[i * 16 + j]];
+			z[0] |= (uint64_t)t[0] << j*4, z[1] |= (uint64_t)t[1] << j*4, z[2] |= (uint64_t)t[2] << j*4;
+		}
+		s->b[i] = z[0], s->b[r->nw + i] = z[1], s->b[r->nw * 2 + i] = z[2];
+	}
+	s->rid = v->rid, s->pos = v->pos;
+	for (i = 1; i < r->n + 1 && i < r->w; ++i) { // from the nearest site
+		const ld_site_t *t = &r->a[(r->k + r->w - i) % r->w];
+		double r2, dp;
+		if (t->rid != s->rid) break;
+		ld_pair(r->nw, t->b, s->b, &r2, &dp);
+		if (r2 < 0. || r2 < min_r2) continue;
+		str->l = 0;
+		kputs(h->id[VCF_DT_CTG][s->rid].key, str); kputc('\t', str);
+		kputw(t->pos + 1, str); kputc('\t', str);
+		kputw(s->pos + 1, str);
+		ksprintf(str, "\t%.4g\t%.4g\n", r2, dp);
+		fwrite(str->s, 1, str->l, stdout);
+	}
+	r->k = (r->k + 1) % r->w;
+	if (r->n < r->w) ++r->n;
+}
+
+/*******************
+ * Haplotype match *
+ *******************/
+
+typedef struct {
+	vcfFile *fp;
 	vcf_hdr_t *h;
+	const vcf_hdr_t *hp;
+	vcf1_t *v;
+	int n, has, rid, m_gt, *ctg_map; // ctg_map: query contig to panel contig
+	int32_t *gt;
+	uint8_t *y;
+	kstring_t str;
+} pbq_t;
+
+static void pbq_next(pbq_t *q)
+{
+	do {
+		q->has = vcf_read1(q->fp, q->h, q->v) >= 0;
+		q->rid = q->has? q->ctg_map[q->v->rid] : -1;
+	} while (q->has && q->rid < 0);
+}
+
+static void pbq_get(void *data, int rid, int pos, uint8_t *z) // query alleles at a panel site; 0 if the query lacks the site
+{
+	pbq_t *q = (pbq_t*)data;
+	memset(z, 0, q->n);
+	while (q->has && (q->rid < rid || (q->rid == rid && q->v->pos < pos))) pbq_next(q);
+	if (q->has && q->rid == rid && q->v->pos == pos)
+		vcf_pbwt_alleles(q->h, q->v, z, &q->gt, &q->m_gt);
+}
+
+static void pbq_report(void *data, int i, int j, int rid, int beg, int end, int len)
+{
+	pbq_t *q = (pbq_t*)data;
+	int n_hap = q->hp->n[VCF_DT_SAMPLE] * 2;
+	kstring_t *s = &q->str;
+	s->l = 0;
+	if (i < n_hap) ksprintf(s, "%s:%d\t", q->hp->id[VCF_DT_SAMPLE][i>>1].key, i&1);
+	else ksprintf(s, "%s:%d\t", q->h->id[VCF_DT_SAMPLE][(i-n_hap)>>1].key, (i-n_hap)&1);
+	ksprintf(s, "%s:%d\t%s\t", q->hp->id[VCF_DT_SAMPLE][j>>1].key, j&1, q->hp->id[VCF_DT_CTG][rid].key);
+	kputw(beg + 1, s); kputc('\t', s);
+	kputw(end + 1, s); kputc('\t', s);
+	kputw(len, s); kputc('\n', s);
+	fwrite(s->s, 1, s->l, stdout);
+}
+
+static int pbwt_match(const char *fn, const vcf_hdr_t *h, const char *fn_query, int min_len)
+{
+	vcf_pbwt_t *p;
+	pbq_t q;
+	int i;
+	if ((p = vcf_pbwt_open(fn)) == 0) {
+		fprintf(stderr, "[E::%s] no valid PBWT for '%s'; run '-T pbwt' first\n", __func__, fn);
+		return 1;
+	}
+	memset(&q, 0, sizeof(pbq_t));
+	q.hp = h;
+	if (fn_query) {
+		if ((q.fp = vcf_open(fn_query, "rb", 0)) == 0) {
+			fprintf(stderr, "[E::%s] fail to open '%s'\n", __func__, fn_query);
+			vcf_pbwt_close(p);
+			return 1;
+		}
+		q.h = vcf_hdr_read(q.fp);
+		q.v = vcf_init1();
+		q.n = q.h->n[VCF_DT_SAMPLE] * 2;
+		q.ctg_map = (int*)malloc((q.h->n[VCF_DT_CTG] + 1) * sizeof(int));
+		for (i = 0; i < q.h->n[VCF_DT_CTG]; ++i)
+			q.ctg_map[i] = vcf_id2int(h, VCF_DT_CTG, q.h->id[VCF_DT_CTG][i].key);
+		pbq_next(&q);
+	}
+	vcf_pbwt_match(p, q.n, pbq_get, &q, min_len, pbq_report, &q);
+	if (fn_query) {
+		vcf_destroy1(q.v);
+		vcf_hdr_destroy(q.h);
+		vcf_close(q.fp);
+	}
+	vcf_pbwt_close(p);
+	free(q.ctg_map); free(q.gt); free(q.str.s);
+	return 0;
+}
+
+/*****************
+ * Field queries *
+ *****************/
+
+#define QF_QUAL   0
+#define QF_ID     1
+#define QF_REF    2
+#define QF_ALT    3
+#define QF_FILTER 4
+#define QF_INFO   5
+#define QF_FMT    6
+#define QF_GT     7
+
+typedef struct {
+	int n, m_fmt;
+	int *type, *id; // id: header ID of INFO and FORMAT fields
+	uint8_t *gt;
+	vcf_fmt_t *fmt;
+	kstring_t str;
+} qry_t;
+
+static void qry_destroy(qry_t *q)
+{
+	free(q->type); free(q->id); free(q->gt); free(q->fmt); free(q->str.s);
+	free(q);
+}
+
+static qry_t *qry_init(const vcf_hdr_t *h, const char *fields)
+{
+	qry_t *q;
+	char **list;
+	int i, n;
+	list = read_list(fields, &n);
+	q = (qry_t*)calloc(1, sizeof(qry_t));
+	q->type = (int*)malloc((n + 1) * sizeof(int));
+	q->id = (int*)malloc((n + 1) * sizeof(int));
+	q->gt = (uint8_t*)malloc(h->n[VCF_DT_SAMPLE] / 4 + 1);
+	for (i = 0; i < n; ++i) {
+		const char *p = list[i];
+		int type = QF_INFO, id = -1;
+		if (strcmp(p, "CHROM") == 0 || strcmp(p, "POS") == 0) type = -1; // always printed
+		else if (strcmp(p, "QUAL") == 0) type = QF_QUAL;
+		else if (strcmp(p, "ID") == 0) type = QF_ID;
+		else if (strcmp(p, "REF") == 0) type = QF_REF;
+		else if (strcmp(p, "ALT") == 0) type = QF_ALT;
+		else if (strcmp(p, "FILTER") == 0) type = QF_FILTER;
+		else if (strcmp(p, "GT") == 0 || strcmp(p, "FMT/GT") == 0 || strcmp(p, "FORMAT/GT") == 0) type = QF_GT;
+		else {
+			if (strncmp(p, "INFO/", 5) == 0) p += 5;
+			else if (strncmp(p, "FMT/", 4) == 0) p += 4, type = QF_FMT;
+			else if (strncmp(p, "FORMAT/", 7) == 0) p += 7, type = QF_FMT;
+			if ((id = vcf_id2int(h, VCF_DT_ID, p)) < 0) {
+				fprintf(stderr, "[E::%s] field '%s' is not defined in the header\n", __func__, list[i]);
+				q->n = -1;
+				break;
+			}
+		}
+		if (type >= 0) q->type[q->n] = type, q->id[q->n++] = id;
+	}
+	for (i = 0; i < n; ++i) free(list[i]);
+	free(list);
+	if (q->n < 0) {
+		qry_destroy(q);
+		return 0;
+	}
+	return q;
+}
+
+static int qry_is_site(const qry_t *q) // no INFO or sample fields
+{
+	int k;
+	for (k = 0; k < q->n; ++k)
+		if (q->type[k] > QF_FILTER) return 0;
+	return 1;
+}
+
+static void qry_print(qry_t *q, const vcf_hdr_t *h, vcf1_t *v)
+{
+	kstring_t *s = &q->str;
+	uint8_t *p, *allele, *filter;
+	uint32_t qual;
+	int i, j, k, l, type;
+	s->l = 0;
+	kputs(h->id[VCF_DT_CTG][v->rid].key, s); kputc('\t', s);
+	kputw(v->pos + 1, s);
+	allele = vcf_skip_typed((uint8_t*)v->shared.s);
+	for (filter = allele, i = 0; i < v->n_allele; ++i) filter = vcf_skip_typed(filter);
+	if (v->n_fmt > q->m_fmt) {
+		q->m_fmt = v->n_fmt;
+		q->fmt = (vcf_fmt_t*)realloc(q->fmt, q->m_fmt * sizeof(vcf_fmt_t));
+	}
+	vcf_unpack_fmt_core((uint8_t*)v->indiv.s, v->n_sample, v->n_fmt, q->fmt);
+	for (k = 0; k < q->n; ++k) {
+		kputc('\t', s);
+		l = s->l;
+		switch (q->type[k]) {
+		case QF_QUAL:
+			memcpy(&qual, &v->qual, 4);
+			if (qual != 0x7F800001) ksprintf(s, "%g", v->qual);
+			break;
+		case QF_ID:
+			vcf_fmt_sized_array(s, (uint8_t*)v->shared.s);
+			break;
+		case QF_REF:
+			if (v->n_allele) vcf_fmt_sized_array(s, allele);
+			break;
+		case QF_ALT:
+			for (p = allele, i = 0; i < v->n_allele; ++i) {
+				if (i > 1) kputc(',', s);
+				if (i) p = vcf_fmt_sized_array(s, p);
+				else p = vcf_skip_typed(p);
+			}
+			break;
+		case QF_FILTER:
+			j = vcf_dec_size(filter, &p, &type);
+			for (i = 0; i < j; ++i) {
+				if (i) kputc(';', s);
+				kputs(h->id[VCF_DT_ID][vcf_dec_int1(p, type, &p)].key, s);
+			}
+			break;
+		case QF_INFO:
+			if ((p = vcf_get_info_ptr(h, v, q->id[k])) == 0) break;
+			if (*p>>4) vcf_fmt_sized_array(s, p);
+			else kputc('1', s); // Flag
+			break;
+		case QF_FMT:
+			for (j = 0; j < v->n_fmt && q->fmt[j].id != q->id[k]; ++j);
+			if (j == v->n_fmt) break;
+			for (i = 0; i < v->n_sample; ++i) {
+				vcf_fmt_t *f = &q->fmt[j];
+				if (i) kputc(' ', s);
+				vcf_fmt_array(s, f->n, f->type, f->p + i * f->size);
+			}
+			break;
+		case QF_GT: // vcf_pack_gt2() codes, '.' for missing
+			if (vcf_pack_gt2(h, v, q->gt) < 0) break;
+			for (i = 0; i < v->n_sample; ++i) {
+				int c = q->gt[i>>2] >> (i&3)*2 & 3;
+				kputc(c == 3? '.' : '0' + c, s);
+			}
+			break;
+		}
+		if ((int)s->l == l) kputc('.', s);
+	}
+	kputc('\n', s);
+	fwrite(s->s, 1, s->l, stdout);
+}
+
+typedef struct {
+	const char *fn;
+	vcfFile *fp;
+	vcf_hdr_t *h;
+	vcf1_t *v;
+	int *ctg_map, *id_map;
+	int last_rid; // in the merged header
+} mrg_aux_t;
+
+#define mrg_lt(a, b) ((a)->v->rid < (b)->v->rid || ((a)->v->rid == (b)->v->rid && (a)->v->pos < (b)->v->pos))
+
+static void mrg_heapdown(int n, mrg_aux_t **heap, int i)
+{
+	mrg_aux_t *tmp = heap[i];
+	int k;
+	while ((k = (i << 1) + 1) < n) {
+		if (k + 1 < n && mrg_lt(heap[k+1], heap[k])) ++k;
+		if (!mrg_lt(heap[k], tmp)) break;
+		heap[i] = heap[k]; i = k;
+	}
+	heap[i] = tmp;
+}
+
+static int mrg_next(mrg_aux_t *a, kstring_t *tmp) // 0 on success, -1 at the end and -2 if the order of contigs disagrees with the merged header
+{
+	while (vcf_read1(a->fp, a->h, a->v) >= 0) {
+		if (vcf_translate(a->ctg_map, a->id_map, a->v, tmp) == 0) {
+			if (a->v->rid < a->last_rid) {
+				fprintf(stderr, "[E::%s] the contigs of '%s' are in a different order from those of the other inputs\n", __func__, a->fn);
+				return -2;
+			}
+			a->last_rid = a->v->rid;
+			return 0;
+		}
+		if (vcf_verbose >= 2)
+			fprintf(stderr, "[W::%s] skipped a record of '%s' with an ID absent from the merged header\n", __func__, a->fn);
+	}
+	return -1;
+}
+
+static int merge_sorted(int n, char *const *fn, const char *moder, const char *modew, const char *fn_out)
+{
+	int i, n_heap, ret = 0;
+	vcf_hdr_t *h = 0, **hs;
+	mrg_aux_t *a, **heap = 0;
+	vcfFile *out = 0;
+	kstring_t tmp = {0,0,0};
+
+	a = (mrg_aux_t*)calloc(n, sizeof(mrg_aux_t));
+	hs = (vcf_hdr_t**)calloc(n, sizeof(vcf_hdr_t*));
+	for (i = 0; i < n && ret == 0; ++i) {
+		a[i].fn = fn[i];
+		if ((a[i].fp = vcf_open(fn[i], moder, 0)) == 0) ret = 1; // vcf_open() reports the error
+		else if ((hs[i] = a[i].h = vcf_hdr_read(a[i].fp)) == 0) {
+			fprintf(stderr, "[E::%s] fail to read the header of '%s'\n", __func__, fn[i]);
+			ret = 1;
+		} else a[i].v = vcf_init1();
+	}
+	if (ret == 0 && (h = vcf_hdr_merge(n, hs)) == 0) ret = 1;
+	for (i = 0; i < n && ret == 0; ++i) {
+		a[i].ctg_map = vcf_hdr_idmap(h, a[i].h, VCF_DT_CTG);
+		a[i].id_map = vcf_hdr_idmap(h, a[i].h, VCF_DT_ID);
+		a[i].last_rid = -1;
+	}
+	if (ret == 0 && (out = vcf_open(fn_out? fn_out : "-", modew, 0)) == 0) ret = 1;
+	if (ret == 0) {
+		vcf_hdr_write(out, h);
+		heap = (mrg_aux_t**)malloc(n * sizeof(void*));
+		for (i = n_heap = 0; i < n; ++i)
+			if (mrg_next(&a[i], &tmp) == 0) heap[n_heap++] = &a[i];
+		for (i = n_heap>>1; i >= 0; --i) mrg_heapdown(n_heap, heap, i);
+		while (n_heap > 0) {
+			int r;
+			vcf_write1(out, h, heap[0]->v);
+			if ((r = mrg_next(heap[0], &tmp)) == -2) {
+				ret = 1;
+				break;
+			} else if (r < 0) heap[0] = heap[--n_heap];
+			mrg_heapdown(n_heap, heap, 0);
+		}
+	}
+	if (out) vcf_close(out);
+	for (i = 0; i < n; ++i) {
+		free(a[i].ctg_map); free(a[i].id_map);
+		if (a[i].v) vcf_destroy1(a[i].v);
+		if (a[i].h) vcf_hdr_destroy(a[i].h);
+		if (a[i].fp) vcf_close(a[i].fp);
+	}
+	if (h) vcf_hdr_destroy(h);
+	free(heap); free(hs); free(a); free(tmp.s);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int task = 0; // 0 for conversion, 1 for counting, 2 for site frequency, 3 for BCF concatenation, 4 for merging, 5 for header caching, 6 for sample statistics, 7/8 for genotype matrices, 9/10 for carriers, 11 for LD, 12/13 for PBWT, 14/15 for the columnar store and 16/17 for the sites table and the ID index
+	int c, ret = 0, clevel = -1, flag = 0, n_imap = -1, *imap = 0, ld_win = 100, excl_late = 0;
+	int min_match = 20;
+	double ld_min_r2 = 0.2;
+	char *fn_ref = 0, *fn_out = 0, *fn_query = 0, *fields = 0, *ids = 0, *samples = 0, *excl = 0, *expr = 0, *sexpr = 0, moder[8];
+	uint8_t *smask = 0;
+	vcf_hdr_t *h, *hw;
+	vcf_expr_t *e = 0, *se = 0;
 	vcfFile *in;
 	vcf1_t *v;
 
-	while ((c = getopt(argc, argv, "l:bSt:o:T:")) >= 0) {
+	while ((c = getopt(argc, argv, "l:bSt:o:T:s:x:Gi:e:M:w:r:q:L:Cf:PI:")) >= 0) {
 		switch (c) {
 		case 'l': clevel = atoi(optarg); flag |= 2; break;
 		case 'S': flag |= 1; break;
 		case 'b': flag |= 2; break;
 		case 't': fn_ref = optarg; flag |= 1; break;
 		case 'o': fn_out = optarg; break;
+		case 's': samples = optarg; break;
+		case 'x': excl = optarg; break;
+		case 'G': flag |= 4; break;
+		case 'i': expr = optarg; flag &= ~8; break;
+		case 'e': expr = optarg; flag |= 8; break;
+		case 'M': sexpr = optarg; break;
+		case 'w': ld_win = atoi(optarg); break;
+		case 'r': ld_min_r2 = atof(optarg); break;
+		case 'q': fn_query = optarg; break;
+		case 'L': min_match = atoi(optarg); break;
+		case 'C': flag |= 16; break;
+		case 'P': flag |= 32; break;
+		case 'I': ids = optarg; break;
+		case 'f': fields = optarg; break;
 		case 'T':
 			if (strcmp(optarg, "count") == 0) task = 1;
 			else if (strcmp(optarg, "freq") == 0) task = 2;
+			else if (strcmp(optarg, "concat") == 0) task = 3;
+			else if (strcmp(optarg, "merge") == 0) task = 4;
+			else if (strcmp(optarg, "hdx") == 0) task = 5;
+			else if (strcmp(optarg, "samplestats") == 0) task = 6;
+			else if (strcmp(optarg, "gtm") == 0) task = 7;
+			else if (strcmp(optarg, "gtmt") == 0) task = 8;
+			else if (strcmp(optarg, "cix") == 0) task = 9;
+			else if (strcmp(optarg, "carriers") == 0) task = 10;
+			else if (strcmp(optarg, "ld") == 0) task = 11;
+			else if (strcmp(optarg, "pbwt") == 0) task = 12;
+			else if (strcmp(optarg, "match") == 0) task = 13;
+			else if (strcmp(optarg, "col") == 0) task = 14;
+			else if (strcmp(optarg, "query") == 0) task = 15;
+			else if (strcmp(optarg, "sti") == 0) task = 16;
+			else if (strcmp(optarg, "ids") == 0) task = 17;
 			break;
 		}
 	}
 	if (argc == optind) {
-		fprintf(stderr, "Usage: bcf2ls [-bS] [-t ref.fai] [-l level] [-T count|freq] <in.bcf>\n");
+		fprintf(stderr, "Usage: bcf2ls [-bSGCP] [-t ref.fai] [-l level] [-s list|file] [-x FORMAT/PL,...] [-i|-e expr] [-I ID,...|file] [-M sample_expr] [-T count|freq|samplestats|carriers] <in.bcf>\n");
+		fprintf(stderr, "       bcf2ls -T concat [-l level] [-o out.bcf] <in1.bcf> [...]\n");
+		fprintf(stderr, "       bcf2ls -T merge [-bS] [-l level] [-o out.bcf] <in1.bcf> [...]\n");
+		fprintf(stderr, "       bcf2ls -T gtm|gtmt [-s list|file] [-i|-e expr] [-M sample_expr] -o out.gtm <in.bcf>\n");
+		fprintf(stderr, "       bcf2ls -T ld [-w win=100] [-r min_r2=0.2] [-s list|file] [-i|-e expr] [-M sample_expr] <in.bcf>\n");
+		fprintf(stderr, "       bcf2ls -T match [-q query.bcf] [-L min_sites=20] <in.bcf>\n");
+		fprintf(stderr, "       bcf2ls -T query -f QUAL,FILTER,INFO/DP,FMT/AD,GT,... [-s list|file] [-i|-e expr] [-M sample_expr] <in.bcf>\n");
+		fprintf(stderr, "       bcf2ls -T hdx|cix|pbwt|col|sti|ids <in.bcf>\n");
 		return 1;
 	}
+	if (task == 3) return concat_bin(argc - optind, argv + optind, fn_out, clevel);
 	strcpy(moder, "r");
 	if ((flag&1) == 0) strcat(moder, "b");
+	if (task == 4) {
+		char modew[8];
+		strcpy(modew, "w");
+		if (clevel >= 0 && clevel <= 9) sprintf(modew + 1, "%d", clevel);
+		if (flag&2) strcat(modew, "b");
+		return merge_sorted(argc - optind, argv + optind, moder, modew, fn_out);
+	}
 
-	in = vcf_open(argv[optind], moder, fn_ref);
-	h = vcf_hdr_read(in);
+	if ((in = vcf_open(argv[optind], moder, fn_ref)) == 0) return 1; // vcf_open() reports the error
+	if ((h = hw = vcf_hdr_read(in)) == 0) {
+		fprintf(stderr, "[E::%s] fail to read the header of '%s'\n", __func__, argv[optind]);
+		vcf_close(in);
+		return 1;
+	}
+	if (task == 5) { // write the header dictionary cache
+		if (!in->is_bin || vcf_hdr_cache_save(h, argv[optind]) < 0) {
+			fprintf(stderr, "[E::%s] fail to write the header cache of '%s'\n", __func__, argv[optind]);
+			ret = 1;
+		}
+		vcf_hdr_destroy(h);
+		vcf_close(in);
+		return ret;
+	}
+	if (task == 9 || task == 12 || task == 14 || task == 16 || task == 17) { // write the carrier index, the PBWT, the columnar store, the sites table or the ID index
+		const char *name;
+		int r = -1;
+		if (task == 9) name = "carrier index", r = in->is_bin? vcf_cix_build(argv[optind]) : -1;
+		else if (task == 12) name = "PBWT", r = in->is_bin? vcf_pbwt_build(argv[optind]) : -1;
+		else if (task == 14) name = "columnar store", r = in->is_bin? vcf_col_build(argv[optind]) : -1;
+		else if (task == 16) name = "sites table", r = in->is_bin? vcf_sti_build(argv[optind]) : -1;
+		else name = "ID index", r = in->is_bin? vcf_ids_build(argv[optind]) : -1;
+		if (r < 0) {
+			fprintf(stderr, "[E::%s] fail to write the %s of '%s'\n", __func__, name, argv[optind]);
+			ret = 1;
+		}
+		vcf_hdr_destroy(h);
+		vcf_close(in);
+		return ret;
+	}
+	if (task == 13) { // set-maximal haplotype matches
+		ret = pbwt_match(argv[optind], h, fn_query, min_match);
+		vcf_hdr_destroy(h);
+		vcf_close(in);
+		return ret;
+	}
 	v = vcf_init1();
+	if (flag&4) { // sites only
+		imap = (int*)malloc(sizeof(int));
+		hw = vcf_hdr_subset(h, 0, 0, imap);
+		n_imap = 0;
+		vcf_hdr_set_samples(h, 0, imap);
+	} else if (samples) {
+		int i, n;
+		char **list;
+		list = read_list(samples, &n);
+		imap = (int*)malloc((n + 1) * sizeof(int));
+		hw = vcf_hdr_subset(h, n, list, imap);
+		n_imap = hw->n[VCF_DT_SAMPLE];
+		vcf_hdr_set_samples(h, n_imap, imap); // for VCF, unselected samples are skipped by the parser
+		for (i = 0; i < n; ++i) free(list[i]);
+		free(list);
+	}
+	if ((expr && (e = vcf_expr_compile(h, expr)) == 0) || (sexpr && (se = vcf_expr_compile_smpl(h, sexpr)) == 0)) {
+		vcf_expr_destroy(e);
+		vcf_destroy1(v);
+		if (hw != h) vcf_hdr_destroy(hw);
+		vcf_hdr_destroy(h);
+		vcf_close(in);
+		free(imap);
+		return 1;
+	}
+	if (se) smask = (uint8_t*)malloc(h->n[VCF_DT_SAMPLE] + 1);
+	if (excl) { // fields read by -i/-e/-M are dropped after filtering, so that VCF and BCF are filtered alike
+		int i, n, type, id, r;
+		char **list;
+		list = read_list(excl, &n);
+		for (i = 0; i < n; ++i) {
+			char *p = list[i];
+			if (strncmp(p, "INFO/", 5) == 0) type = VCF_HL_INFO, p += 5;
+			else if (strncmp(p, "FORMAT/", 7) == 0) type = VCF_HL_FMT, p += 7;
+			else type = VCF_HL_INFO;
+			id = vcf_id2int(h, VCF_DT_ID, p);
+			if (id >= 0 && ((e && vcf_expr_has_key(e, type, id)) || (se && vcf_expr_has_key(se, type, id))))
+				r = vcf_hdr_exclude_late(h, type, p), excl_late = 1;
+			else r = vcf_hdr_exclude(h, type, p);
+			if (r < 0)
+				fprintf(stderr, "[W::%s] field '%s' is not defined in the header. Skipped.\n", __func__, list[i]);
+			free(list[i]);
+		}
+		free(list);
+	}
 
 	if (task == 0) {
 		vcfFile *out;
+		vcf_col_writer_t *cw = 0;
+		vcf_sti_writer_t *sw = 0;
+		vcf_ids_writer_t *iw = 0;
+		idq_t *q = 0;
 		char modew[8];
 		strcpy(modew, "w");
 		if (clevel >= 0 && clevel <= 9) sprintf(modew + 1, "%d", clevel);
 		if (flag&2) strcat(modew, "b");
 		out = vcf_open(fn_out? fn_out : "-", modew, 0);
-		vcf_hdr_write(out, h);
-		while (vcf_read1(in, h, v) >= 0) vcf_write1(out, h, v);
+		vcf_hdr_write(out, hw);
+		if (flag&(16|32)) { // write the columnar store and/or the sites table alongside
+			if ((flag&2) && fn_out) {
+				if (flag&16) cw = vcf_col_open_w(fn_out, hw);
+				if (flag&32) sw = vcf_sti_open_w(fn_out, hw), iw = vcf_ids_open_w(fn_out);
+			} else fprintf(stderr, "[W::%s] -C and -P require BCF output to a file (-b -o); ignored\n", __func__);
+		}
+		if (ids) q = idq_init(in->is_bin? argv[optind] : 0, ids);
+		while ((q? idq_read1(q, in, h, v, e, flag>>3&1) : read1_filtered(in, h, v, e, flag>>3&1)) >= 0) {
+			int64_t voff = vcf_tell(out);
+			if (n_imap >= 0) vcf_subset_samples(v, n_imap, imap);
+			if (se && vcf_expr_eval_smpl(se, v, smask)) vcf_set_gt_missing(h, v, smask);
+			if (excl && (in->is_bin || excl_late)) vcf_exclude_fields(h, v);
+			if (sw) vcf_sti_write1(sw, v, voff);
+			if (iw) vcf_ids_write1(iw, v, voff);
+			vcf_write1(out, hw, v);
+			if (cw) vcf_col_write1(cw, hw, v);
+		}
 		vcf_close(out);
+		if (cw && vcf_col_close_w(cw) < 0)
+			fprintf(stderr, "[E::%s] fail to write the columnar store of '%s'\n", __func__, fn_out);
+		if (sw && vcf_sti_close_w(sw) < 0)
+			fprintf(stderr, "[E::%s] fail to write the sites table of '%s'\n", __func__, fn_out);
+		if (iw && vcf_ids_close_w(iw) < 0)
+			fprintf(stderr, "[E::%s] fail to write the ID index of '%s'\n", __func__, fn_out);
+		if (q) idq_destroy(q);
 	} else if (task == 1) {
 		int64_t cnt = 0;
-		while (vcf_read1(in, h, v) >= 0) ++cnt;
+		vcf_sti_t *sti = 0;
+		if (in->is_bin && e == 0 && (sti = vcf_sti_load(argv[optind])) != 0) cnt = sti->n_site;
+		else while (read1_filtered(in, h, v, e, flag>>3&1) >= 0) ++cnt;
+		vcf_sti_destroy(sti);
 		printf("%ld\n", (long)cnt);
-	} else if (task == 2) { // FIXME: not working for >=10 alleles
-		int gt, *n_allele;
-		gt = vcf_id2int(h, VCF_DT_ID, "GT");
-		n_allele = (int*)alloca(64 * sizeof(int));
-		while (vcf_read1(in, h, v) >= 0) {
-			int i, j, l;
-			vcf_fmt_t *fmt;
-			for (i = 0; i < 10; ++i) n_allele[i] = 0;
-			fmt = vcf_unpack_fmt(h, v);
-			for (i = 0; i < v->n_fmt; ++i)
-				if (fmt[i].id == gt) break;
-			if (i != v->n_fmt) { // has GT
-				int8_t *p = (int8_t*)fmt[i].p;
-				for (j = 0; j < v->n_sample; ++j, p += fmt[i].n)
-					for (l = 0; l < fmt[i].n; ++l)
-						if (p[l]>>1) ++n_allele[(p[l]>>1)-1];
-				printf("%s\t%d", h->id[VCF_DT_CTG][v->rid].key, v->pos + 1);
-				for (i = 0; i < v->n_allele; ++i) printf("\t%d", n_allele[i]);
-				putchar('\n');
-			}
-			free(fmt);
+	} else if (task == 2) { // allele counts and frequencies of ALT alleles
+		int32_t *ac = 0;
+		int m_ac = 0;
+		kstring_t str = {0,0,0};
+		while (read1_filtered(in, h, v, e, flag>>3&1) >= 0) {
+			int i, an;
+			if (n_imap >= 0) vcf_subset_samples(v, n_imap, imap);
+			if (se && vcf_expr_eval_smpl(se, v, smask)) vcf_set_gt_missing(h, v, smask);
+			if ((an = vcf_count_alleles(h, v, &ac, &m_ac)) < 0) continue;
+			str.l = 0;
+			kputs(h->id[VCF_DT_CTG][v->rid].key, &str); kputc('\t', &str);
+			kputw(v->pos + 1, &str); kputc('\t', &str);
+			kputw(an, &str); kputc('\t', &str);
+			for (i = 1; i < v->n_allele; ++i) {
+				if (i > 1) kputc(',', &str);
+				kputw(ac[i], &str);
+			}
+			if (v->n_allele < 2) kputc('.', &str);
+			kputc('\t', &str);
+			for (i = 1; i < v->n_allele; ++i) {
+				if (i > 1) kputc(',', &str);
+				if (an) ksprintf(&str, "%g", (double)ac[i] / an);
+				else kputc('.', &str);
+			}
+			if (v->n_allele < 2) kputc('.', &str);
+			kputc('\n', &str);
+			fwrite(str.s, 1, str.l, stdout);
+		}
+		free(ac); free(str.s);
+	} else if (task == 6) {
+		sstat_t *ss;
+		ss = sstat_init(hw->n[VCF_DT_SAMPLE]);
+		while (read1_filtered(in, h, v, e, flag>>3&1) >= 0) {
+			if (n_imap >= 0) vcf_subset_samples(v, n_imap, imap);
+			if (se && vcf_expr_eval_smpl(se, v, smask)) vcf_set_gt_missing(h, v, smask);
+			sstat_add(ss, h, v);
+		}
+		sstat_print(ss, hw);
+		sstat_destroy(ss);
+	} else if (task == 10) { // non-reference genotypes; from the carrier index if it exists and the records need not be read
+		vcf_cix_t *cix = 0;
+		uint32_t *a = 0;
+		int n, m_a = 0, rid, pos;
+		kstring_t str = {0,0,0};
+		if (in->is_bin && e == 0 && se == 0 && n_imap < 0)
+			cix = vcf_cix_open(argv[optind], h);
+		for (;;) {
+			int i;
+			if (cix) {
+				if ((n = vcf_cix_read1(cix, &rid, &pos, &a, &m_a)) < 0) break;
+			} else {
+				if (read1_filtered(in, h, v, e, flag>>3&1) < 0) break;
+				if (n_imap >= 0) vcf_subset_samples(v, n_imap, imap);
+				if (se && vcf_expr_eval_smpl(se, v, smask)) vcf_set_gt_missing(h, v, smask);
+				if ((n = vcf_get_carriers(h, v, &a, &m_a)) < 0) n = 0;
+				rid = v->rid, pos = v->pos;
+			}
+			str.l = 0;
+			kputs(h->id[VCF_DT_CTG][rid].key, &str); kputc('\t', &str);
+			kputw(pos + 1, &str); kputc('\t', &str);
+			kputw(n, &str); kputc('\t', &str);
+			for (i = 0; i < n; ++i) {
+				if (i) kputc(',', &str);
+				kputs(hw->id[VCF_DT_SAMPLE][a[i]>>2].key, &str);
+				kputc(':', &str); kputc('0' + (a[i]&3), &str);
+			}
+			if (n == 0) kputc('.', &str);
+			kputc('\n', &str);
+			fwrite(str.s, 1, str.l, stdout);
+		}
+		vcf_cix_close(cix);
+		free(a); free(str.s);
+	} else if (task == 11) { // r^2 and D' between each site and the previous win-1 sites
+		ld_ring_t *r;
+		kstring_t str = {0,0,0};
+		r = ld_init(hw->n[VCF_DT_SAMPLE], ld_win > 1? ld_win : 2);
+		while (read1_filtered(in, h, v, e, flag>>3&1) >= 0) {
+			if (n_imap >= 0) vcf_subset_samples(v, n_imap, imap);
+			if (se && vcf_expr_eval_smpl(se, v, smask)) vcf_set_gt_missing(h, v, smask);
+			ld_add(r, h, v, ld_min_r2, &str);
+		}
+		ld_destroy(r);
+		free(str.s);
+	} else if (task == 15) { // selected fields; from the columnar store if it exists and the records need not be read
+		vcf_col_t *col = 0;
+		vcf_sti_t *sti = 0;
+		qry_t *q;
+		if ((q = qry_init(h, fields? fields : "")) == 0) ret = 1; // qry_init() reports the error
+		else if (in->is_bin && e == 0 && se == 0 && n_imap < 0) { // the sites table suffices for site fields
+			if (qry_is_site(q)) sti = vcf_sti_load(argv[optind]);
+			if (sti == 0) col = vcf_col_open(argv[optind], h, fields);
+		}
+		if (sti) {
+			int64_t i;
+			for (i = 0; i < sti->n_site && vcf_sti_get(sti, i, v) == 0; ++i)
+				qry_print(q, h, v);
+			vcf_sti_destroy(sti);
+		} else if (col) {
+			while (vcf_col_read1(col, v) >= 0) qry_print(q, h, v);
+			vcf_col_close(col);
+		} else if (q) {
+			while (read1_filtered(in, h, v, e, flag>>3&1) >= 0) {
+				if (n_imap >= 0) vcf_subset_samples(v, n_imap, imap);
+				if (se && vcf_expr_eval_smpl(se, v, smask)) vcf_set_gt_missing(h, v, smask);
+				qry_print(q, h, v);
+			}
+		}
+		if (q) qry_destroy(q);
+	} else if (task == 7 || task == 8) { // 2-bit genotype matrix, variant- or sample-major
+		vcf_gtm_writer_t *w;
+		if (fn_out == 0 || (w = vcf_gtm_open(fn_out, hw, task == 7? VCF_GTM_SITE : VCF_GTM_SAMPLE)) == 0) {
+			fprintf(stderr, "[E::%s] fail to create the genotype matrix; -o is required\n", __func__);
+			ret = 1;
+		} else {
+			while (read1_filtered(in, h, v, e, flag>>3&1) >= 0) {
+				if (n_imap >= 0) vcf_subset_samples(v, n_imap, imap);
+				if (se && vcf_expr_eval_smpl(se, v, smask)) vcf_set_gt_missing(h, v, smask);
+				vcf_gtm_write1(w, h, v);
+			}
+			if (vcf_gtm_close(w) < 0) {
+				fprintf(stderr, "[E::%s] fail to write '%s'\n", __func__, fn_out);
+				ret = 1;
+			}
 		}
 	}
 
+	vcf_expr_destroy(e); vcf_expr_destroy(se);
+	free(smask);
 	vcf_destroy1(v);
+	if (hw != h) vcf_hdr_destroy(hw);
 	vcf_hdr_destroy(h);
 	vcf_close(in);
-	return 0;
+	free(imap);
+	return ret;
 }
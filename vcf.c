@@ -5,6 +5,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "kstring.h"
 #include "bgzf.h"
 #include "vcf.h"
@@ -16,11 +20,191 @@ typedef khash_t(vdict) vdict_t;
 #include "kseq.h"
 KSTREAM_INIT(gzFile, gzread, 16384)
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 int vcf_verbose = 3; // 1: error; 2: warning; 3: message; 4: progress; 5: debugging; >=10: pure debugging
 uint32_t vcf_missing_float = 0x7F800001;
 uint8_t vcf_type_shift[] = { 0, 0, 1, 2, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 static vcf_idinfo_t vcf_idinfo_def = { { 15, 15, 15 }, -1 };
 
+typedef struct {
+	int key, w, size; // w: number of values (or chars) per sample; size: bytes per sample
+	int max_n; // max number of values (or chars) seen on the current line
+	uint32_t is_gt:1, is_excl:1, unit:30; // unit: bytes per value
+	uint32_t y;
+	kstring_t *buf; // n_sample*size bytes; buffers are kept in hdr_aux_t across lines
+} fmt_aux_t;
+
+/* Immutable dictionary built by vcf_hdr_sync() for lookups on the parsing
+   hot path. Keys are packed in one string pool. Slots are probed in groups
+   of 16: each slot has a one-byte tag (0 for empty; otherwise 0x80 | 7 bits
+   of the hash) and all tags in a group are compared at once. */
+typedef struct {
+	uint32_t mask; // number of groups minus 1
+	uint8_t *tag;
+	int32_t *slot; // index into off[]/len[], which is also the ID
+	uint32_t *off, *len;
+	char *pool;
+} fdict_t;
+
+#define FMT_CACHE_SIZE 4
+
+typedef struct { // a FORMAT string and its resolved layout
+	kstring_t str;
+	int n_fmt;
+	fmt_aux_t *fmt;
+} fmt_cache_t;
+
+typedef struct { // parsing auxiliary data kept in vcf_hdr_t::aux
+	int n_keep;
+	uint8_t *keep; // if not NULL, keep[i] is set if the i-th sample column is kept
+	uint8_t *excl; // if not NULL, excl[id]>>VCF_HL_INFO&1 is set if INFO/id is dropped; similarly for FORMAT
+	int32_t *fmt_w; // width of each FORMAT field on the last line; used as the guess for the next line
+	int m_fbuf;
+	kstring_t *fbuf; // per-field buffers for vcf_parse1()
+	// memoized lookups; consecutive lines usually share CHROM, FILTER and FORMAT
+	int last_rid, n_flt, m_flt, i_fmt_cache;
+	int32_t *flt;
+	kstring_t last_chrom, last_flt;
+	fmt_cache_t fmt_cache[FMT_CACHE_SIZE];
+	fdict_t *fd[3]; // fd[VCF_DT_SAMPLE] is built on the first lookup by name
+	// string pool for contig and sample names; chunks are never moved
+	int n_chunk;
+	size_t chunk_l, chunk_m;
+	char **chunk;
+	int n_smpl; // samples are not hashed; vcf_hdr_sync() fills vcf_hdr_t::id[] from smpl[]
+	char **smpl;
+	vcf_idinfo_t *smpl_info;
+	// memory-mapped dictionary cache; if set, fd[] and vcf_hdr_t::id[] point into it
+	void *map;
+	size_t l_map;
+} hdr_aux_t;
+
+typedef struct { // per-record auxiliary data kept in vcf1_t::aux
+	int is_built, m_info;
+	uint32_t gen; // incremented each time the table is rebuilt
+	uint32_t *info_gen; // info_off[id] is valid iff info_gen[id] == gen
+	int32_t *info_off; // offset of the typed value of INFO/id in vcf1_t::shared
+} rec_aux_t;
+
+static inline void rec_reset(vcf1_t *v) // call whenever vcf1_t::shared is rewritten
+{
+	if (v->aux) ((rec_aux_t*)v->aux)->is_built = 0;
+}
+
+#define POOL_CHUNK_SIZE 0x10000
+
+static char *pool_alloc(hdr_aux_t *a, size_t l)
+{
+	char *p;
+	if (a->chunk_m - a->chunk_l < l) {
+		a->chunk_m = l > POOL_CHUNK_SIZE? l : POOL_CHUNK_SIZE;
+		a->chunk = (char**)realloc(a->chunk, (a->n_chunk + 1) * sizeof(char*));
+		a->chunk[a->n_chunk++] = (char*)malloc(a->chunk_m);
+		a->chunk_l = 0;
+	}
+	p = a->chunk[a->n_chunk - 1] + a->chunk_l;
+	a->chunk_l += l;
+	return p;
+}
+
+static inline hdr_aux_t *get_hdr_aux(const vcf_hdr_t *h)
+{
+	if (h->aux == 0) ((vcf_hdr_t*)h)->aux = calloc(1, sizeof(hdr_aux_t));
+	return (hdr_aux_t*)h->aux;
+}
+
+/*************************
+ * Immutable dictionary *
+ *************************/
+
+static inline uint64_t fd_hash(const char *s, int l)
+{
+	uint64_t h = (uint64_t)l * 0x9E3779B97F4A7C15ULL, x;
+	for (; l >= 8; s += 8, l -= 8) {
+		memcpy(&x, s, 8);
+		h = (h ^ x) * 0xbf58476d1ce4e5b9ULL;
+		h ^= h >> 31;
+	}
+	x = 0;
+	memcpy(&x, s, l);
+	h = (h ^ x) * 0x94d049bb133111ebULL;
+	return h ^ h >> 29;
+}
+
+static inline uint32_t fd_match(const uint8_t *g, uint8_t tag, uint32_t *empty) // bit i is set if g[i]==tag
+{
+#ifdef __SSE2__
+	__m128i x = _mm_loadu_si128((const __m128i*)g);
+	*empty = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128()));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8((char)tag)));
+#else
+	uint32_t i, m = 0;
+	for (i = 0, *empty = 0; i < 16; ++i) {
+		if (g[i] == tag) m |= 1U<<i;
+		if (g[i] == 0) *empty |= 1U<<i;
+	}
+	return m;
+#endif
+}
+
+static fdict_t *fd_build(int n, char *const *key)
+{
+	fdict_t *d;
+	int i, n_groups = 1;
+	size_t l_pool = 0;
+	d = (fdict_t*)calloc(1, sizeof(fdict_t));
+	while (n_groups * 14 < n) n_groups <<= 1; // load factor <= 7/8
+	d->mask = n_groups - 1;
+	d->tag = (uint8_t*)calloc(n_groups, 16);
+	d->slot = (int32_t*)calloc(n_groups * 16, 4);
+	d->off = (uint32_t*)malloc((n + 1) * 4);
+	d->len = (uint32_t*)malloc((n + 1) * 4);
+	for (i = 0; i < n; ++i) {
+		d->len[i] = strlen(key[i]);
+		d->off[i] = l_pool;
+		l_pool += d->len[i] + 1;
+	}
+	d->pool = (char*)malloc(l_pool + 1);
+	for (i = 0; i < n; ++i) {
+		uint64_t h;
+		uint32_t g, j, empty;
+		memcpy(d->pool + d->off[i], key[i], d->len[i] + 1);
+		h = fd_hash(key[i], d->len[i]);
+		for (g = h>>7 & d->mask;; g = (g + 1) & d->mask) {
+			fd_match(d->tag + g * 16, 0, &empty);
+			if (empty) break;
+		}
+		for (j = 0; (empty>>j&1) == 0; ++j);
+		d->tag[g * 16 + j] = 0x80 | (h & 0x7f);
+		d->slot[g * 16 + j] = i;
+	}
+	return d;
+}
+
+static void fd_destroy(fdict_t *d)
+{
+	if (d == 0) return;
+	free(d->tag); free(d->slot); free(d->off); free(d->len); free(d->pool);
+	free(d);
+}
+
+static inline int fd_get(const fdict_t *d, const char *s, int l) // return the ID or -1 if absent
+{
+	uint64_t h = fd_hash(s, l);
+	uint32_t g, m, empty;
+	uint8_t tag = 0x80 | (h & 0x7f);
+	for (g = h>>7 & d->mask;; g = (g + 1) & d->mask) {
+		for (m = fd_match(d->tag + g * 16, tag, &empty); m; m &= m - 1) {
+			int i = d->slot[g * 16 + __builtin_ctz(m)];
+			if (d->len[i] == (uint32_t)l && memcmp(d->pool + d->off[i], s, l) == 0) return i;
+		}
+		if (empty) return -1;
+	}
+}
+
 /*************
  * Basic I/O *
  *************/
@@ -36,7 +220,10 @@ vcfFile *vcf_open(const char *fn, const char *mode, const char *fn_ref)
 	}
 	if (fp->is_bin) {
 		if (fp->is_write) fp->fp = strcmp(fn, "-")? bgzf_open(fn, mode) : bgzf_dopen(fileno(stdout), mode);
-		else fp->fp = strcmp(fn, "-")? bgzf_open(fn, "r") : bgzf_dopen(fileno(stdin), "r");
+		else {
+			fp->fp = strcmp(fn, "-")? bgzf_open(fn, "r") : bgzf_dopen(fileno(stdin), "r");
+			if (strcmp(fn, "-")) fp->fn = strdup(fn);
+		}
 	} else {
 		if (fp->is_write) {
 			fp->fp = strcmp(fn, "-")? fopen(fn, "rb") : stdout;
@@ -50,7 +237,7 @@ vcfFile *vcf_open(const char *fn, const char *mode, const char *fn_ref)
 	if (fp->fp == 0) {
 		if (vcf_verbose >= 2)
 			fprintf(stderr, "[E::%s] fail to open file '%s'\n", __func__, fn);
-		free(fp->fn_ref); free(fp);
+		free(fp->fn_ref); free(fp->fn); free(fp);
 		return 0;
 	}
 	return fp;
@@ -67,7 +254,24 @@ void vcf_close(vcfFile *fp)
 			free(fp->fn_ref);
 		} else fclose((FILE*)fp->fp);
 	} else bgzf_close((BGZF*)fp->fp);
-	free(fp);
+	free(fp->fn); free(fp);
+}
+
+int64_t vcf_tell(const vcfFile *fp)
+{
+	const BGZF *bgzf = (const BGZF*)fp->fp;
+	return fp->is_bin? bgzf_tell(bgzf) : -1;
+}
+
+int vcf_seek(vcfFile *fp, int64_t voff)
+{
+	BGZF *bgzf = (BGZF*)fp->fp;
+	if (!fp->is_bin || fp->is_write) return -1;
+	if (bgzf->block_length > 0 && voff>>16 == bgzf->block_address && (voff&0xFFFF) <= bgzf->block_length) { // within the loaded block
+		bgzf->block_offset = voff&0xFFFF;
+		return 0;
+	}
+	return bgzf_seek(bgzf, voff, SEEK_SET) < 0? -1 : 0;
 }
 
 /*********************
@@ -169,11 +373,29 @@ void vcf_hdr_destroy(vcf_hdr_t *h)
 	khint_t k;
 	for (i = 0; i < 3; ++i) {
 		vdict_t *d = (vdict_t*)h->dict[i];
-		for (k = kh_begin(d); k != kh_end(d); ++k)
-			if (kh_exist(d, k)) free((char*)kh_key(d, k));
+		if (i == VCF_DT_ID) // contig and sample names are kept in the string pool
+			for (k = kh_begin(d); k != kh_end(d); ++k)
+				if (kh_exist(d, k)) free((char*)kh_key(d, k));
 		kh_destroy(vdict, d);
 		free(h->id[i]);
 	}
+	if (h->aux) {
+		hdr_aux_t *a = (hdr_aux_t*)h->aux;
+		for (i = 0; i < a->m_fbuf; ++i) free(a->fbuf[i].s);
+		for (i = 0; i < FMT_CACHE_SIZE; ++i) {
+			free(a->fmt_cache[i].str.s);
+			free(a->fmt_cache[i].fmt);
+		}
+		free(a->last_chrom.s); free(a->last_flt.s); free(a->flt);
+		if (a->map) {
+			for (i = 0; i < 3; ++i) free(a->fd[i]);
+			munmap(a->map, a->l_map);
+		} else for (i = 0; i < 3; ++i) fd_destroy(a->fd[i]);
+		for (i = 0; i < a->n_chunk; ++i) free(a->chunk[i]);
+		free(a->chunk); free(a->smpl); free(a->smpl_info);
+		free(a->keep); free(a->excl); free(a->fmt_w); free(a->fbuf);
+		free(a);
+	}
 	free(h->mem.s); free(h->text);
 	free(h);
 }
@@ -189,7 +411,7 @@ int vcf_hdr_parse1(vcf_hdr_t *h, const char *str)
 
 		len = vcf_hdr_parse_line2(str, &info, &id_beg, &id_end);
 		if (len < 0) return -1;
-		s = (char*)malloc(id_end - id_beg + 1);
+		s = len > 0? pool_alloc(get_hdr_aux(h), id_end - id_beg + 1) : (char*)malloc(id_end - id_beg + 1);
 		strncpy(s, str + id_beg, id_end - id_beg);
 		s[id_end - id_beg] = 0;
 		if (len > 0) { // a contig line
@@ -198,7 +420,6 @@ int vcf_hdr_parse1(vcf_hdr_t *h, const char *str)
 			if (ret == 0) {
 				if (vcf_verbose >= 2)
 					fprintf(stderr, "[W::%s] Duplicated contig name '%s'. Skipped.\n", __func__, s);
-				free(s);
 			} else {
 				kh_val(d, k) = vcf_idinfo_def;
 				kh_val(d, k).id = kh_size(d) - 1;
@@ -223,27 +444,24 @@ int vcf_hdr_parse1(vcf_hdr_t *h, const char *str)
 		// check if "PASS" is in the dictionary
 		k = kh_get(vdict, d, "PASS");
 		if (k == kh_end(d)) vcf_hdr_parse1(h, "##FILTER=<ID=PASS>"); // if not, add it; this is a recursion
-		// add samples
-		d = (vdict_t*)h->dict[VCF_DT_SAMPLE];
-		for (p = q = str;; ++q) {
-			int ret;
-			if (*q != '\t' && *q != 0) continue;
-			if (++i > 9) {
-				char *s;
-				s = (char*)malloc(q - p + 1);
-				strncpy(s, p, q - p);
-				s[q - p] = 0;
-				k = kh_put(vdict, d, s, &ret);
-				if (ret) { // absent
-					kh_val(d, k) = vcf_idinfo_def;
-					kh_val(d, k).id = kh_size(d) - 1;
-				} else {
-					if (vcf_verbose >= 2)
-						fprintf(stderr, "[W::%s] Duplicated sample name '%s'. Skipped.\n", __func__, s);
-				}
+		// add samples: copy the line to the string pool and split it in place
+		for (p = str; *p && i < 9; ++p)
+			if (*p == '\t') ++i;
+		if (i == 9) {
+			hdr_aux_t *a = get_hdr_aux(h);
+			char *s, *t;
+			int n = 1, l = strlen(p);
+			for (q = p; *q; ++q)
+				if (*q == '\t') ++n;
+			s = pool_alloc(a, l + 1);
+			memcpy(s, p, l + 1);
+			a->smpl = (char**)realloc(a->smpl, n * sizeof(char*));
+			for (a->n_smpl = 0, t = s, i = 0; i <= l; ++i) {
+				if (s[i] != '\t' && s[i] != 0) continue;
+				s[i] = 0;
+				a->smpl[a->n_smpl++] = t;
+				t = s + i + 1;
 			}
-			if (*q == 0) break;
-			p = q + 1;
 		}
 	}
 	return 0;
@@ -251,17 +469,32 @@ int vcf_hdr_parse1(vcf_hdr_t *h, const char *str)
 
 int vcf_hdr_sync(vcf_hdr_t *h)
 {
-	int i;
-	for (i = 0; i < 3; ++i) {
+	int i, j;
+	hdr_aux_t *a = get_hdr_aux(h);
+	for (i = 0; i < 2; ++i) {
 		khint_t k;
+		char **key;
 		vdict_t *d = (vdict_t*)h->dict[i];
 		h->n[i]  = kh_size(d);
 		h->id[i] = (vcf_idpair_t*)malloc(kh_size(d) * sizeof(vcf_idpair_t));
+		key = (char**)malloc((kh_size(d) + 1) * sizeof(char*));
 		for (k = kh_begin(d); k != kh_end(d); ++k) {
 			if (!kh_exist(d, k)) continue;
-			h->id[i][kh_val(d, k).id].key = kh_key(d, k);
+			h->id[i][kh_val(d, k).id].key = key[kh_val(d, k).id] = (char*)kh_key(d, k);
 			h->id[i][kh_val(d, k).id].val = &kh_val(d, k);
 		}
+		a->fd[i] = fd_build(h->n[i], key);
+		free(key);
+	}
+	// samples; the lookup table is built by vcf_id2int() on demand
+	h->n[VCF_DT_SAMPLE] = a->n_smpl;
+	h->id[VCF_DT_SAMPLE] = (vcf_idpair_t*)malloc((a->n_smpl + 1) * sizeof(vcf_idpair_t));
+	a->smpl_info = (vcf_idinfo_t*)malloc((a->n_smpl + 1) * sizeof(vcf_idinfo_t));
+	for (j = 0; j < a->n_smpl; ++j) {
+		a->smpl_info[j] = vcf_idinfo_def;
+		a->smpl_info[j].id = j;
+		h->id[VCF_DT_SAMPLE][j].key = a->smpl[j];
+		h->id[VCF_DT_SAMPLE][j].val = &a->smpl_info[j];
 	}
 	return 0;
 }
@@ -269,6 +502,16 @@ int vcf_hdr_sync(vcf_hdr_t *h)
 int vcf_hdr_parse(vcf_hdr_t *h)
 {
 	char *p, *q;
+	int n_ctg = 0, n_id = 0;
+	for (p = h->text; *p; ++p) { // count the dictionary lines to pre-size the hash tables
+		if (p[0] == '#' && p[1] == '#') {
+			if (strncmp(p + 2, "contig=", 7) == 0) ++n_ctg;
+			else ++n_id;
+		}
+		if ((p = strchr(p, '\n')) == 0) break;
+	}
+	kh_resize(vdict, (vdict_t*)h->dict[VCF_DT_CTG], n_ctg / 0.75 + 1);
+	kh_resize(vdict, (vdict_t*)h->dict[VCF_DT_ID], n_id / 0.75 + 1);
 	for (p = q = h->text;; ++q) {
 		int c;
 		if (*q != '\n' && *q != 0) continue;
@@ -282,10 +525,397 @@ int vcf_hdr_parse(vcf_hdr_t *h)
 	return 0;
 }
 
+/***************************
+ * Header dictionary cache *
+ ***************************/
+
+/* The cache "in.bcf.hdx" holds the dictionaries of a BCF header in the same
+   layout as fdict_t plus the vcf_idinfo_t array, so that vcf_hdr_read() can
+   mmap it and skip vcf_hdr_parse(). The cache is only used if the CRC32 and
+   the length of the header text match.
+
+   Layout: "HDX\1", l_text, crc32, n[3], then for each dictionary: mask,
+   l_pool, tag[(mask+1)*16], slot[(mask+1)*16], off[n], len[n], pool[l_pool]
+   and vcf_idinfo_t[n]. Each array starts at an 8-byte boundary. */
+
+#define HDX_MAGIC "HDX\1"
+
+static inline size_t hdx_align(size_t l) { return (l + 7) & ~(size_t)7; }
+
+static void hdx_write(FILE *fp, const void *p, size_t l)
+{
+	static const char zero[8] = {0,0,0,0,0,0,0,0};
+	fwrite(p, 1, l, fp);
+	fwrite(zero, 1, hdx_align(l) - l, fp);
+}
+
+static const void *hdx_take(const uint8_t **p, const uint8_t *end, size_t l)
+{
+	const uint8_t *q = *p;
+	if ((size_t)(end - q) < hdx_align(l)) return 0;
+	*p += hdx_align(l);
+	return q;
+}
+
+static uint32_t hdx_crc(const vcf_hdr_t *h)
+{
+	return crc32(crc32(0L, Z_NULL, 0), (const Bytef*)h->text, h->l_text);
+}
+
+int vcf_hdr_cache_save(const vcf_hdr_t *h, const char *fn)
+{
+	FILE *fp;
+	char *str, *tmp;
+	uint32_t x[5];
+	vcf_idinfo_t *info;
+	int i, j, ret;
+	if (h->aux == 0) return -1;
+	vcf_id2int(h, VCF_DT_SAMPLE, ""); // make sure the sample table is built
+	str = (char*)malloc(strlen(fn) + 5);
+	tmp = (char*)malloc(strlen(fn) + 9);
+	strcat(strcpy(str, fn), ".hdx");
+	strcat(strcpy(tmp, str), ".tmp"); // write to a temporary file as the old cache may be mapped
+	if ((fp = fopen(tmp, "wb")) == 0) {
+		free(str); free(tmp);
+		return -1;
+	}
+	x[0] = h->l_text, x[1] = hdx_crc(h);
+	for (i = 0; i < 3; ++i) x[i+2] = h->n[i];
+	fwrite(HDX_MAGIC, 1, 4, fp);
+	fwrite(x, 4, 5, fp);
+	for (i = 0; i < 3; ++i) {
+		const fdict_t *d = ((hdr_aux_t*)h->aux)->fd[i];
+		size_t n_slots = (size_t)(d->mask + 1) * 16;
+		x[0] = d->mask;
+		x[1] = h->n[i]? d->off[h->n[i]-1] + d->len[h->n[i]-1] + 1 : 0;
+		hdx_write(fp, x, 8);
+		hdx_write(fp, d->tag, n_slots);
+		hdx_write(fp, d->slot, n_slots * 4);
+		hdx_write(fp, d->off, h->n[i] * 4);
+		hdx_write(fp, d->len, h->n[i] * 4);
+		hdx_write(fp, d->pool, x[1]);
+		info = (vcf_idinfo_t*)malloc((h->n[i] + 1) * sizeof(vcf_idinfo_t));
+		for (j = 0; j < h->n[i]; ++j) info[j] = *h->id[i][j].val;
+		hdx_write(fp, info, h->n[i] * sizeof(vcf_idinfo_t));
+		free(info);
+	}
+	ret = fclose(fp) == 0 && rename(tmp, str) == 0? 0 : -1;
+	free(str); free(tmp);
+	return ret;
+}
+
+static int hdx_load(vcf_hdr_t *h, const char *fn)
+{
+	int fd, i, j;
+	char *str;
+	struct stat st;
+	const uint8_t *p, *end;
+	const uint32_t *x;
+	hdr_aux_t *a;
+	fdict_t *d[3];
+	const vcf_idinfo_t *info[3];
+	void *map;
+
+	str = (char*)malloc(strlen(fn) + 5);
+	strcat(strcpy(str, fn), ".hdx");
+	fd = open(str, O_RDONLY);
+	free(str);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < 24) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return -1;
+	p = (const uint8_t*)map, end = p + st.st_size;
+	x = (const uint32_t*)(p + 4);
+	if (memcmp(p, HDX_MAGIC, 4) != 0 || x[0] != (uint32_t)h->l_text || x[1] != hdx_crc(h)) {
+		if (vcf_verbose >= 2)
+			fprintf(stderr, "[W::%s] the header cache of '%s' is stale; ignored\n", __func__, fn);
+		munmap(map, st.st_size);
+		return -1;
+	}
+	for (i = 0; i < 3; ++i) h->n[i] = x[i+2];
+	p += 24;
+	memset(d, 0, sizeof(d));
+	for (i = 0; i < 3; ++i) {
+		size_t n_slots;
+		if ((x = (const uint32_t*)hdx_take(&p, end, 8)) == 0) break;
+		d[i] = (fdict_t*)calloc(1, sizeof(fdict_t));
+		d[i]->mask = x[0];
+		n_slots = ((size_t)x[0] + 1) * 16;
+		d[i]->tag  = (uint8_t*) hdx_take(&p, end, n_slots);
+		d[i]->slot = (int32_t*) hdx_take(&p, end, n_slots * 4);
+		d[i]->off  = (uint32_t*)hdx_take(&p, end, h->n[i] * 4);
+		d[i]->len  = (uint32_t*)hdx_take(&p, end, h->n[i] * 4);
+		d[i]->pool = (char*)    hdx_take(&p, end, x[1]);
+		info[i] = (const vcf_idinfo_t*)hdx_take(&p, end, h->n[i] * sizeof(vcf_idinfo_t));
+		if (d[i]->tag == 0 || d[i]->slot == 0 || d[i]->off == 0 || d[i]->len == 0 || d[i]->pool == 0 || info[i] == 0) break;
+		for (j = 0; j < (int)n_slots; ++j)
+			if (d[i]->tag[j] && (d[i]->slot[j] < 0 || d[i]->slot[j] >= h->n[i])) break;
+		if (j < (int)n_slots) break;
+		for (j = 0; j < h->n[i]; ++j) // keys must be in the pool and NULL terminated
+			if ((uint64_t)d[i]->off[j] + d[i]->len[j] >= x[1] || d[i]->pool[d[i]->off[j] + d[i]->len[j]] != 0) break;
+		if (j < h->n[i]) break;
+	}
+	if (i < 3) {
+		if (vcf_verbose >= 2)
+			fprintf(stderr, "[W::%s] the header cache of '%s' is corrupted; ignored\n", __func__, fn);
+		for (j = 0; j <= i && j < 3; ++j) free(d[j]);
+		munmap(map, st.st_size);
+		memset(h->n, 0, sizeof(h->n));
+		return -1;
+	}
+	a = get_hdr_aux(h);
+	a->map = map, a->l_map = st.st_size;
+	for (i = 0; i < 3; ++i) {
+		a->fd[i] = d[i];
+		h->id[i] = (vcf_idpair_t*)malloc((h->n[i] + 1) * sizeof(vcf_idpair_t));
+		for (j = 0; j < h->n[i]; ++j) {
+			h->id[i][j].key = d[i]->pool + d[i]->off[j];
+			h->id[i][j].val = &info[i][j];
+		}
+	}
+	return 0;
+}
+
+/************
+ * Sidecars *
+ ************/
+
+int vcf_file_key(const char *fn, uint64_t key[3])
+{
+	struct stat st;
+	FILE *fp;
+	uint8_t *buf;
+	size_t l;
+	int ret = 0;
+	if (stat(fn, &st) < 0 || (fp = fopen(fn, "rb")) == 0) return -1;
+	l = st.st_size < 0x10000? st.st_size : 0x10000; // the last BGZF blocks, including the EOF marker
+	buf = (uint8_t*)malloc(l + 1);
+	if (fseeko(fp, st.st_size - l, SEEK_SET) < 0 || fread(buf, 1, l, fp) != l) ret = -1;
+	key[0] = st.st_size, key[1] = st.st_mtime;
+	key[2] = crc32(crc32(0L, Z_NULL, 0), buf, l);
+	free(buf);
+	fclose(fp);
+	return ret;
+}
+
+static char *sidecar_name(const char *fn, const char *ext, int is_tmp)
+{
+	char *str;
+	str = (char*)malloc(strlen(fn) + strlen(ext) + 5);
+	strcat(strcpy(str, fn), ext);
+	return is_tmp? strcat(str, ".tmp") : str;
+}
+
+int vcf_sidecar_open(const char *fn, const char *ext, const char *magic, const char *name)
+{
+	uint8_t hdr[VCF_SIDECAR_HDR];
+	uint64_t key[3];
+	char *str;
+	int fd;
+	if (vcf_file_key(fn, key) < 0) return -1;
+	str = sidecar_name(fn, ext, 0);
+	fd = open(str, O_RDONLY);
+	free(str);
+	if (fd < 0) return -1;
+	if (read(fd, hdr, VCF_SIDECAR_HDR) != VCF_SIDECAR_HDR || memcmp(hdr, magic, 4) != 0) {
+		if (vcf_verbose >= 2)
+			fprintf(stderr, "[W::%s] the %s of '%s' is corrupted; ignored\n", __func__, name, fn);
+		close(fd);
+		return -1;
+	}
+	if (memcmp(hdr + 8, key, 24) != 0) {
+		if (vcf_verbose >= 2)
+			fprintf(stderr, "[W::%s] the %s of '%s' is stale; ignored\n", __func__, name, fn);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int vcf_sidecar_open_w(const char *fn, const char *ext, const char *magic)
+{
+	uint8_t hdr[VCF_SIDECAR_HDR];
+	char *tmp;
+	int fd;
+	tmp = sidecar_name(fn, ext, 1); // write to a temporary file as the old sidecar may be in use
+	if ((fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0666)) >= 0) {
+		memset(hdr, 0, VCF_SIDECAR_HDR);
+		memcpy(hdr, magic, 4);
+		if (write(fd, hdr, VCF_SIDECAR_HDR) != VCF_SIDECAR_HDR) {
+			close(fd);
+			remove(tmp);
+			fd = -1;
+		}
+	}
+	free(tmp);
+	return fd;
+}
+
+int vcf_sidecar_close_w(const char *fn, const char *ext, int ret)
+{
+	uint64_t key[3];
+	char *str, *tmp;
+	int fd;
+	str = sidecar_name(fn, ext, 0);
+	tmp = sidecar_name(fn, ext, 1);
+	if (ret == 0 && (vcf_file_key(fn, key) < 0 || (fd = open(tmp, O_WRONLY)) < 0)) ret = -1;
+	if (ret == 0) {
+		if (pwrite(fd, key, 24, 8) != 24) ret = -1;
+		if (close(fd) != 0) ret = -1;
+	}
+	if (ret == 0 && rename(tmp, str) != 0) ret = -1;
+	if (ret < 0) remove(tmp);
+	free(str); free(tmp);
+	return ret;
+}
+
+/*****************
+ * Carrier index *
+ *****************/
+
+/* "in.bcf.cix" is a sidecar (see vcf_sidecar_open()) followed by a BGZF
+   stream: n_sample as int32, then per record rid, pos, n and n packed
+   carriers, as returned by vcf_get_carriers(). Records without GT have no
+   carriers. */
+
+#define CIX_MAGIC "CIX\3"
+
+struct vcf_cix_t {
+	BGZF *fp;
+	int n_sample, n_ctg;
+};
+
+int vcf_cix_build(const char *fn)
+{
+	vcfFile *in = 0;
+	vcf_hdr_t *h;
+	vcf1_t *v;
+	BGZF *out;
+	uint32_t *c = 0;
+	int32_t x[3];
+	int fd, m_c = 0, ret = 0;
+	if ((fd = vcf_sidecar_open_w(fn, ".cix", CIX_MAGIC)) < 0) return -1;
+	out = bgzf_dopen(fd, "w");
+	if (out == 0 || (in = vcf_open(fn, "rb", 0)) == 0) {
+		if (out) bgzf_close(out);
+		else close(fd);
+		return vcf_sidecar_close_w(fn, ".cix", -1);
+	}
+	h = vcf_hdr_read(in);
+	v = vcf_init1();
+	x[0] = h->n[VCF_DT_SAMPLE];
+	bgzf_write(out, x, 4);
+	while (vcf_read1(in, h, v) >= 0) {
+		x[0] = v->rid, x[1] = v->pos;
+		if ((x[2] = vcf_get_carriers(h, v, &c, &m_c)) < 0) x[2] = 0;
+		bgzf_write(out, x, 12);
+		bgzf_write(out, c, x[2] * 4);
+	}
+	if (bgzf_close(out) != 0) ret = -1;
+	vcf_destroy1(v);
+	vcf_hdr_destroy(h);
+	vcf_close(in);
+	free(c);
+	return vcf_sidecar_close_w(fn, ".cix", ret);
+}
+
+vcf_cix_t *vcf_cix_open(const char *fn, const vcf_hdr_t *h)
+{
+	vcf_cix_t *c;
+	BGZF *fp;
+	int fd;
+	if ((fd = vcf_sidecar_open(fn, ".cix", CIX_MAGIC, "carrier index")) < 0) return 0;
+	if ((fp = bgzf_dopen(fd, "r")) == 0) {
+		close(fd);
+		return 0;
+	}
+	c = (vcf_cix_t*)calloc(1, sizeof(vcf_cix_t));
+	c->fp = fp;
+	c->n_ctg = h->n[VCF_DT_CTG];
+	if (bgzf_read(fp, &c->n_sample, 4) != 4 || c->n_sample != h->n[VCF_DT_SAMPLE]) {
+		if (vcf_verbose >= 2)
+			fprintf(stderr, "[W::%s] the carrier index of '%s' is corrupted; ignored\n", __func__, fn);
+		vcf_cix_close(c);
+		return 0;
+	}
+	return c;
+}
+
+int vcf_cix_read1(vcf_cix_t *c, int *rid, int *pos, uint32_t **a, int *m_a)
+{
+	int32_t x[3];
+	int i, l;
+	if ((l = bgzf_read(c->fp, x, 12)) == 0) return -1;
+	if (l != 12 || x[0] < 0 || x[0] >= c->n_ctg || x[2] < 0 || x[2] > c->n_sample) goto bad;
+	if (x[2] > *m_a) {
+		*m_a = x[2];
+		kroundup32(*m_a);
+		*a = (uint32_t*)realloc(*a, *m_a * 4);
+	}
+	if (bgzf_read(c->fp, *a, x[2] * 4) != x[2] * 4) goto bad;
+	for (i = 0; i < x[2]; ++i)
+		if ((*a)[i]>>2 >= (uint32_t)c->n_sample) goto bad;
+	*rid = x[0], *pos = x[1];
+	return x[2];
+
+bad:
+	if (vcf_verbose >= 1)
+		fprintf(stderr, "[E::%s] the carrier index has a malformed record\n", __func__);
+	return -1;
+}
+
+void vcf_cix_close(vcf_cix_t *c)
+{
+	if (c == 0) return;
+	bgzf_close(c->fp);
+	free(c);
+}
+
 /******************
  * VCF header I/O *
  ******************/
 
+static int hdr_add_fai(const char *fn, kstring_t *txt) // append a contig line per "name length ..." line of _fn_, typically a .fai
+{
+	gzFile f;
+	kstring_t buf = {0,0,0};
+	char *p, *q, *r, *end;
+	int n;
+	size_t n_line = 0;
+	if ((f = gzopen(fn, "r")) == 0) return -1;
+	for (;;) { // slurp the file; the contig lines are then built in one pass
+		ks_resize(&buf, buf.l + 0x10000);
+		if ((n = gzread(f, buf.s + buf.l, 0x10000)) <= 0) break;
+		buf.l += n;
+	}
+	gzclose(f);
+	if (n < 0) {
+		free(buf.s);
+		return -1;
+	}
+	for (p = buf.s, end = buf.s + buf.l; p < end; ++p)
+		if (*p == '\n') ++n_line;
+	ks_resize(txt, txt->l + buf.l + (n_line + 1) * 24); // 24: the length of "##contig=<ID=,length=>\n" + 1
+	for (p = buf.s; p < end; p = q + 1) {
+		for (q = p; q < end && *q != '\n'; ++q);
+		for (r = p; r < q && !isspace(*r); ++r);
+		if (r == p) continue; // an empty line
+		kputsn("##contig=<ID=", 13, txt); kputsn(p, r - p, txt);
+		kputsn(",length=", 8, txt);
+		for (; r < q && isspace(*r); ++r);
+		for (p = r; r < q && isdigit(*r); ++r);
+		if (r > p) kputsn(p, r - p, txt);
+		else kputc('0', txt);
+		kputsn(">\n", 2, txt);
+	}
+	free(buf.s);
+	return 0;
+}
+
 vcf_hdr_t *vcf_hdr_read(vcfFile *fp)
 {
 	vcf_hdr_t *h;
@@ -297,6 +927,7 @@ vcf_hdr_t *vcf_hdr_read(vcfFile *fp)
 		bgzf_read((BGZF*)fp->fp, &h->l_text, 4);
 		h->text = (char*)malloc(h->l_text);
 		bgzf_read((BGZF*)fp->fp, h->text, h->l_text);
+		if (fp->fn && hdx_load(h, fp->fn) == 0) return h; // the dictionaries are read from the cache
 	} else {
 		int dret;
 		kstring_t txt, *s = &fp->line;
@@ -310,25 +941,12 @@ vcf_hdr_t *vcf_hdr_read(vcfFile *fp)
 				vcf_hdr_destroy(h);
 				return 0;
 			}
-			if (s->s[1] != '#' && fp->fn_ref) { // insert contigs here
-				gzFile f;
-				kstream_t *ks;
-				kstring_t tmp;
-				tmp.l = tmp.m = 0; tmp.s = 0;
-				f = gzopen(fp->fn_ref, "r");
-				ks = ks_init(f);
-				while (ks_getuntil(ks, 0, &tmp, &dret) >= 0) {
-					int c;
-					kputs("##contig=<ID=", &txt); kputs(tmp.s, &txt);
-					ks_getuntil(ks, 0, &tmp, &dret);
-					kputs(",length=", &txt); kputw(atol(tmp.s), &txt);
-					kputsn(">\n", 2, &txt);
-					if (dret != '\n')
-						while ((c = ks_getc(ks)) != '\n' && c != -1); // skip the rest of the line
-				}
-				free(tmp.s);
-				ks_destroy(ks);
-				gzclose(f);
+			if (s->s[1] != '#' && fp->fn_ref && hdr_add_fai(fp->fn_ref, &txt) < 0) { // insert contigs here
+				if (vcf_verbose >= 1)
+					fprintf(stderr, "[E::%s] fail to read the sequence dictionary '%s'\n", __func__, fp->fn_ref);
+				free(txt.s);
+				vcf_hdr_destroy(h);
+				return 0;
 			}
 			kputsn(s->s, s->l, &txt);
 			if (s->s[1] != '#') break;
@@ -355,39 +973,291 @@ void vcf_hdr_write(vcfFile *fp, const vcf_hdr_t *h)
 	}
 }
 
+int vcf_hdr_compat(const vcf_hdr_t *h0, const vcf_hdr_t *h1)
+{
+	int i, j;
+	for (i = 0; i < 3; ++i) {
+		if (h0->n[i] != h1->n[i]) return 0;
+		for (j = 0; j < h0->n[i]; ++j) {
+			const vcf_idpair_t *p0 = &h0->id[i][j], *p1 = &h1->id[i][j];
+			if (strcmp(p0->key, p1->key) != 0) return 0;
+			if (memcmp(p0->val->info, p1->val->info, sizeof(p0->val->info)) != 0) return 0;
+		}
+	}
+	return 1;
+}
+
+vcf_hdr_t *vcf_hdr_merge(int n, vcf_hdr_t *const *h)
+{
+	int i, j;
+	kstring_t txt, line;
+	vcf_hdr_t *m;
+	char *chrom;
+	txt.l = txt.m = 0; txt.s = 0;
+	line.l = line.m = 0; line.s = 0;
+	for (i = 1; i < n; ++i) { // check samples
+		if (h[i]->n[VCF_DT_SAMPLE] != h[0]->n[VCF_DT_SAMPLE]) break;
+		for (j = 0; j < h[0]->n[VCF_DT_SAMPLE]; ++j)
+			if (strcmp(h[0]->id[VCF_DT_SAMPLE][j].key, h[i]->id[VCF_DT_SAMPLE][j].key) != 0) break;
+		if (j != h[0]->n[VCF_DT_SAMPLE]) break;
+	}
+	if (i != n) {
+		if (vcf_verbose >= 1)
+			fprintf(stderr, "[E::%s] input %d has different samples from the first input\n", __func__, i);
+		return 0;
+	}
+	m = vcf_hdr_init();
+	for (i = 0, chrom = 0; i < n; ++i) {
+		char *p, *q;
+		for (p = q = h[i]->text;; ++q) {
+			if (*q != '\n' && *q != 0) continue;
+			line.l = 0;
+			kputsn(p, q - p, &line);
+			if (line.l > 1 && line.s[0] == '#' && line.s[1] == '#') {
+				int keep = (i == 0);
+				if (!keep) {
+					uint32_t info;
+					int len, id_beg, id_end;
+					len = vcf_hdr_parse_line2(line.s, &info, &id_beg, &id_end);
+					if (len >= 0) {
+						vdict_t *d = (vdict_t*)m->dict[len > 0? VCF_DT_CTG : VCF_DT_ID];
+						khint_t k;
+						int c = line.s[id_end];
+						line.s[id_end] = 0;
+						k = kh_get(vdict, d, line.s + id_beg);
+						line.s[id_end] = c;
+						if (k == kh_end(d)) keep = 1;
+						else if (len == 0) {
+							uint32_t y = kh_val(d, k).info[info&0xf];
+							if (y == 15) keep = 1;
+							else if (y != info && vcf_verbose >= 2)
+								fprintf(stderr, "[W::%s] inconsistent definitions of %s; the first is used\n", __func__, line.s + id_beg);
+						}
+					}
+				}
+				if (keep) {
+					vcf_hdr_parse1(m, line.s);
+					kputsn(line.s, line.l, &txt);
+					kputc('\n', &txt);
+				}
+			} else if (i == 0 && line.l > 0 && line.s[0] == '#') chrom = p;
+			if (*q == 0) break;
+			p = q + 1;
+		}
+	}
+	if (chrom) {
+		for (i = 0; chrom[i] && chrom[i] != '\n'; ++i);
+		kputsn(chrom, i, &txt);
+		vcf_hdr_parse1(m, txt.s + txt.l - i);
+	}
+	free(line.s);
+	m->l_text = txt.l + 1;
+	m->text = txt.s;
+	vcf_hdr_sync(m);
+	return m;
+}
+
+int *vcf_hdr_idmap(const vcf_hdr_t *dst, const vcf_hdr_t *src, int which)
+{
+	int i, is_identity = 1, *map;
+	map = (int*)malloc((src->n[which] + 1) * sizeof(int));
+	for (i = 0; i < src->n[which]; ++i) {
+		map[i] = vcf_id2int(dst, which, src->id[which][i].key);
+		if (map[i] != i) is_identity = 0;
+	}
+	if (is_identity) {
+		free(map);
+		return 0;
+	}
+	return map;
+}
+
+static int intcmp(const void *a, const void *b)
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+vcf_hdr_t *vcf_hdr_subset(const vcf_hdr_t *h0, int n, char *const *samples, int *imap)
+{
+	int i, j, m;
+	kstring_t txt;
+	char *p;
+	vcf_hdr_t *h;
+	for (i = m = 0; i < n; ++i) {
+		int x = vcf_id2int(h0, VCF_DT_SAMPLE, samples[i]);
+		if (x < 0) {
+			if (vcf_verbose >= 2)
+				fprintf(stderr, "[W::%s] sample '%s' is not present in the header. Skipped.\n", __func__, samples[i]);
+		} else imap[m++] = x;
+	}
+	qsort(imap, m, sizeof(int), intcmp);
+	for (i = j = 0; i < m; ++i) // remove duplicates
+		if (i == 0 || imap[i] != imap[j-1]) imap[j++] = imap[i];
+	m = j;
+	// copy the header lines and the fixed columns of the "#CHROM" line
+	txt.l = txt.m = 0; txt.s = 0;
+	for (p = h0->text; *p; ) {
+		char *q;
+		for (q = p; *q && *q != '\n'; ++q);
+		if (p[0] == '#' && p[1] != '#') break;
+		kputsn(p, q - p, &txt);
+		if (*q == 0) break;
+		kputc('\n', &txt);
+		p = q + 1;
+	}
+	for (i = 0; *p && *p != '\n'; ++p) { // without samples, FORMAT is dropped, too
+		if (*p == '\t' && ++i == (m? 9 : 8)) break;
+		kputc(*p, &txt);
+	}
+	for (i = 0; i < m; ++i) {
+		kputc('\t', &txt);
+		kputs(h0->id[VCF_DT_SAMPLE][imap[i]].key, &txt);
+	}
+	h = vcf_hdr_init();
+	h->l_text = txt.l + 1;
+	h->text = txt.s;
+	vcf_hdr_parse(h);
+	return h;
+}
+
+void vcf_hdr_set_samples(vcf_hdr_t *h, int n, const int *imap)
+{
+	hdr_aux_t *a = get_hdr_aux(h);
+	int i;
+	free(a->keep);
+	a->keep = 0, a->n_keep = 0;
+	if (n < 0 || n == h->n[VCF_DT_SAMPLE]) return;
+	a->keep = (uint8_t*)calloc(h->n[VCF_DT_SAMPLE], 1);
+	for (i = 0; i < n; ++i) a->keep[imap[i]] = 1;
+	a->n_keep = n;
+}
+
+#define EXCL_LATE 4 // excl[id]>>(type+EXCL_LATE)&1: dropped by vcf_exclude_fields() but not by vcf_parse1()
+
+static int hdr_exclude(vcf_hdr_t *h, int type, const char *key, int shift)
+{
+	hdr_aux_t *a = get_hdr_aux(h);
+	int id;
+	id = vcf_id2int(h, VCF_DT_ID, key);
+	if (id < 0 || h->id[VCF_DT_ID][id].val->info[type] == 15) return -1;
+	if (a->excl == 0) a->excl = (uint8_t*)calloc(h->n[VCF_DT_ID], 1);
+	a->excl[id] |= 1<<(type + shift);
+	for (id = 0; id < FMT_CACHE_SIZE; ++id) // the cached layouts are stale
+		a->fmt_cache[id].str.l = 0;
+	return 0;
+}
+
+int vcf_hdr_exclude(vcf_hdr_t *h, int type, const char *key)
+{
+	return hdr_exclude(h, type, key, 0);
+}
+
+int vcf_hdr_exclude_late(vcf_hdr_t *h, int type, const char *key)
+{
+	return hdr_exclude(h, type, key, EXCL_LATE);
+}
+
 /*******************
  * Typed value I/O *
  *******************/
 
-void vcf_enc_vint(kstring_t *s, int n, int32_t *a, int wsize)
+#ifdef __SSE2__
+static inline __m128i mm_max_epi32(__m128i a, __m128i b) // SSE2 lacks pmaxsd
+{
+	__m128i m = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+static inline __m128i mm_min_epi32(__m128i a, __m128i b)
+{
+	__m128i m = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, a));
+}
+
+static inline int32_t mm_hreduce_epi32(__m128i x, int is_max)
+{
+	__m128i y = _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+	x = is_max? mm_max_epi32(x, y) : mm_min_epi32(x, y);
+	y = _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+	x = is_max? mm_max_epi32(x, y) : mm_min_epi32(x, y);
+	return _mm_cvtsi128_si32(x);
+}
+#endif
+
+// min and max of a[], skipping missing values (INT32_MIN)
+static void vint_range(int n, const int32_t *a, int32_t *_min, int32_t *_max)
 {
 	int32_t max = INT32_MIN + 1, min = INT32_MAX;
-	int i;
+	int i = 0;
+#ifdef __SSE2__
+	if (n >= 8) {
+		__m128i vmin = _mm_set1_epi32(INT32_MAX), vmax = _mm_set1_epi32(INT32_MIN + 1);
+		__m128i miss = _mm_set1_epi32(INT32_MIN), vbig = vmin;
+		for (; i + 4 <= n; i += 4) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i m = _mm_cmpeq_epi32(x, miss);
+			vmax = mm_max_epi32(vmax, x); // a missing value never wins max()
+			vmin = mm_min_epi32(vmin, _mm_or_si128(_mm_andnot_si128(m, x), _mm_and_si128(m, vbig)));
+		}
+		max = mm_hreduce_epi32(vmax, 1);
+		min = mm_hreduce_epi32(vmin, 0);
+	}
+#endif
+	for (; i < n; ++i) {
+		if (a[i] == INT32_MIN) continue;
+		if (max < a[i]) max = a[i];
+		if (min > a[i]) min = a[i];
+	}
+	*_min = min, *_max = max;
+}
+
+void vcf_enc_vint(kstring_t *s, int n, int32_t *a, int wsize)
+{
+	int32_t max, min;
+	int i = 0;
 	if (n == 0) vcf_enc_size(s, 0, VCF_BT_NULL);
 	else if (n == 1) vcf_enc_int1(s, a[0]);
 	else {
 		if (wsize <= 0) wsize = n;
-		for (i = 0; i < n; ++i) {
-			if (a[i] == INT32_MIN) continue;
-			if (max < a[i]) max = a[i];
-			if (min > a[i]) min = a[i];
-		}
+		vint_range(n, a, &min, &max);
 		if (max <= INT8_MAX && min > INT8_MIN) {
+			int8_t *p;
 			vcf_enc_size(s, wsize, VCF_BT_INT8);
-			for (i = 0; i < n; ++i)
-				kputc(a[i] == INT32_MIN? INT8_MIN : a[i], s);
+			ks_resize(s, s->l + n + 1);
+			p = (int8_t*)s->s + s->l;
+#ifdef __SSE2__
+			for (; i + 16 <= n; i += 16) { // saturation maps INT32_MIN to INT8_MIN
+				__m128i x0 = _mm_loadu_si128((const __m128i*)(a + i));
+				__m128i x1 = _mm_loadu_si128((const __m128i*)(a + i + 4));
+				__m128i x2 = _mm_loadu_si128((const __m128i*)(a + i + 8));
+				__m128i x3 = _mm_loadu_si128((const __m128i*)(a + i + 12));
+				__m128i y = _mm_packs_epi16(_mm_packs_epi32(x0, x1), _mm_packs_epi32(x2, x3));
+				_mm_storeu_si128((__m128i*)(p + i), y);
+			}
+#endif
+			for (; i < n; ++i)
+				p[i] = a[i] == INT32_MIN? INT8_MIN : a[i];
+			s->l += n;
 		} else if (max <= INT16_MAX && min > INT16_MIN) {
+			int16_t *p;
 			vcf_enc_size(s, wsize, VCF_BT_INT16);
-			for (i = 0; i < n; ++i) {
+			ks_resize(s, s->l + n * 2 + 1);
+			p = (int16_t*)(s->s + s->l);
+#ifdef __SSE2__
+			for (; i + 8 <= n; i += 8) { // saturation maps INT32_MIN to INT16_MIN
+				__m128i x0 = _mm_loadu_si128((const __m128i*)(a + i));
+				__m128i x1 = _mm_loadu_si128((const __m128i*)(a + i + 4));
+				_mm_storeu_si128((__m128i*)(p + i), _mm_packs_epi32(x0, x1));
+			}
+#endif
+			for (; i < n; ++i) {
 				int16_t x = a[i] == INT32_MIN? INT16_MIN : a[i];
-				kputsn((char*)&x, 2, s);
+				memcpy(p + i, &x, 2);
 			}
+			s->l += n * 2;
 		} else {
 			vcf_enc_size(s, wsize, VCF_BT_INT32);
-			for (i = 0; i < n; ++i) {
-				int32_t x = a[i] == INT32_MIN? INT32_MIN : a[i];
-				kputsn((char*)&x, 4, s);
-			}
+			kputsn((char*)a, n * 4, s);
 		}
 	}
 }
@@ -457,26 +1327,51 @@ vcf1_t *vcf_init1()
 	return v;
 }
 
+void vcf_aux_reset(vcf1_t *v)
+{
+	rec_reset(v);
+}
+
 void vcf_destroy1(vcf1_t *v)
 {
+	if (v->aux) {
+		rec_aux_t *a = (rec_aux_t*)v->aux;
+		free(a->info_gen); free(a->info_off);
+		free(a);
+	}
 	free(v->shared.s); free(v->indiv.s);
 	free(v);
 }
 
-typedef struct {
-	int key, max_m, size, offset;
-	uint32_t is_gt:1, max_g:15, max_l:16;
-	uint32_t y;
-	uint8_t *buf;
-} fmt_aux_t;
+static void fmt_set_missing(const fmt_aux_t *z, uint8_t *x, int l) // fill values l..w-1 with missing values
+{
+	if (z->unit == 1) memset(x + l, 0, z->w - l);
+	else if ((z->y>>4&0xf) == VCF_HT_REAL)
+		for (; l < z->w; ++l) ((int32_t*)x)[l] = 0x7F800001;
+	else
+		for (; l < z->w; ++l) ((int32_t*)x)[l] = INT32_MIN;
+}
 
-static inline void align_mem(kstring_t *s)
+// widen the first n samples to w values each, when a sample exceeds the guessed width
+static void fmt_widen(fmt_aux_t *z, int n, int n_cap, int w)
 {
-	if (s->l&7) {
-		uint64_t zero = 0;
-		int l = ((s->l + 7)>>3<<3) - s->l;
-		kputsn((char*)&zero, l, s);
+	int i, l = z->w, size = w * z->unit;
+	ks_resize(z->buf, (size_t)n_cap * size);
+	z->w = w;
+	for (i = n - 1; i >= 0; --i) {
+		uint8_t *x = (uint8_t*)z->buf->s + i * size;
+		memmove(x, z->buf->s + i * z->size, z->size);
+		fmt_set_missing(z, x, l);
 	}
+	z->size = size;
+}
+
+static void fmt_shrink(fmt_aux_t *z, int n, int w)
+{
+	int i, size = w * z->unit;
+	for (i = 1; i < n; ++i)
+		memmove(z->buf->s + i * size, z->buf->s + i * z->size, size);
+	z->w = w, z->size = size;
 }
 
 int vcf_parse1(kstring_t *s, const vcf_hdr_t *h, vcf1_t *v)
@@ -484,24 +1379,32 @@ int vcf_parse1(kstring_t *s, const vcf_hdr_t *h, vcf1_t *v)
 	int i = 0;
 	char *p, *q, *r, *t;
 	fmt_aux_t *fmt = 0;
-	kstring_t *str, *mem = (kstring_t*)&h->mem;
-	khint_t k;
+	kstring_t *str;
+	hdr_aux_t *ha = get_hdr_aux(h);
+	uint8_t *excl = ha->excl;
 	ks_tokaux_t aux;
 
-	mem->l = v->shared.l = v->indiv.l = 0;
+	v->shared.l = v->indiv.l = 0;
 	str = &v->shared;
-	v->n_fmt = 0;
+	v->n_fmt = 0, v->n_sample = 0;
+	rec_reset(v);
 	for (p = kstrtok(s->s, "\t", &aux), i = 0; p; p = kstrtok(0, 0, &aux), ++i) {
 		q = (char*)aux.p;
 		*q = 0;
 		if (i == 0) { // CHROM
-			vdict_t *d = (vdict_t*)h->dict[VCF_DT_CTG];
-			k = kh_get(vdict, d, p);
-			if (k == kh_end(d)) {
+			int id;
+			if (ha->last_chrom.l > 0 && q - p == (long)ha->last_chrom.l && memcmp(p, ha->last_chrom.s, q - p) == 0) {
+				v->rid = ha->last_rid; // same as the previous line
+				continue;
+			}
+			if ((id = fd_get(ha->fd[VCF_DT_CTG], p, q - p)) < 0) {
 				if (vcf_verbose >= 2)
 					fprintf(stderr, "[W::%s] can't find '%s' in the sequence dictionary\n", __func__, p);
-				return 0;
-			} else v->rid = kh_val(d, k).id;
+				return -1;
+			} else v->rid = id;
+			ha->last_chrom.l = 0;
+			kputsn(p, q - p, &ha->last_chrom);
+			ha->last_rid = v->rid;
 		} else if (i == 1) { // POS
 			v->pos = atoi(p) - 1;
 		} else if (i == 2) { // ID
@@ -511,7 +1414,7 @@ int vcf_parse1(kstring_t *s, const vcf_hdr_t *h, vcf1_t *v)
             if ( q-p>32767 )
             {
                 fprintf(stderr, "[W::%s] The REF too long (%ld), skipping %s:%d\n", __func__, q-p, h->id[VCF_DT_CTG][v->rid].key,v->pos+1);
-                return 0;
+                return -1;
             }
 			vcf_enc_vchar(str, q - p, p);
 			v->n_allele = 1, v->rlen = q - p;
@@ -530,35 +1433,41 @@ int vcf_parse1(kstring_t *s, const vcf_hdr_t *h, vcf1_t *v)
 			if (strcmp(p, ".")) v->qual = atof(p);
 			else memcpy(&v->qual, &vcf_missing_float, 4);
 		} else if (i == 6) { // FILTER
-			if (strcmp(p, ".")) {
+			if (q - p == (long)ha->last_flt.l && memcmp(p, ha->last_flt.s, q - p) == 0) { // same as the previous line
+				vcf_enc_vint(str, ha->n_flt, ha->flt, -1);
+			} else if (strcmp(p, ".")) {
 				int32_t *a;
-				int n_flt = 1, i;
+				int n_flt = 1, i, id;
 				ks_tokaux_t aux1;
-				vdict_t *d = (vdict_t*)h->dict[VCF_DT_ID];
+				ha->last_flt.l = 0;
+				kputsn(p, q - p, &ha->last_flt);
 				// count the number of filters
 				if (*(q-1) == ';') *(q-1) = 0;
 				for (r = p; *r; ++r)
 					if (*r == ';') ++n_flt;
-				a = (int32_t*)alloca(n_flt * 4);
+				if (n_flt > ha->m_flt) {
+					ha->m_flt = n_flt;
+					ha->flt = (int32_t*)realloc(ha->flt, n_flt * 4);
+				}
+				a = ha->flt;
 				// add filters
 				for (t = kstrtok(p, ";", &aux1), i = 0; t; t = kstrtok(0, 0, &aux1)) {
 					*(char*)aux1.p = 0;
-					k = kh_get(vdict, d, t);
-					if (k == kh_end(d)) { // not defined
+					if ((id = fd_get(ha->fd[VCF_DT_ID], t, aux1.p - t)) < 0) { // not defined
 						if (vcf_verbose >= 2) fprintf(stderr, "[W::%s] undefined FILTER '%s'\n", __func__, t);
-					} else a[i++] = kh_val(d, k).id;
+					} else a[i++] = id;
 				}
-				n_flt = i;
+				ha->n_flt = n_flt = i;
 				vcf_enc_vint(str, n_flt, a, -1);
 			} else vcf_enc_vint(str, 0, 0, -1);
 		} else if (i == 7) { // INFO
 			char *key;
-			vdict_t *d = (vdict_t*)h->dict[VCF_DT_ID];
+			const vcf_idpair_t *ids = h->id[VCF_DT_ID];
 			v->n_info = 0;
 			if (strcmp(p, ".")) {
 				if (*(q-1) == ';') *(q-1) = 0;
 				for (r = key = p;; ++r) {
-					int c;
+					int c, id;
 					char *val, *end;
 					if (*r != ';' && *r != '=' && *r != 0) continue;
 					val = end = 0;
@@ -568,13 +1477,14 @@ int vcf_parse1(kstring_t *s, const vcf_hdr_t *h, vcf1_t *v)
 						for (end = val; *end != ';' && *end != 0; ++end);
 						c = *end; *end = 0;
 					} else end = r;
-					k = kh_get(vdict, d, key);
-					if (k == kh_end(d) || kh_val(d, k).info[VCF_HL_INFO] == 15) { // not defined in the header
+					id = fd_get(ha->fd[VCF_DT_ID], key, r - key);
+					if (id < 0 || ids[id].val->info[VCF_HL_INFO] == 15) { // not defined in the header
 						if (vcf_verbose >= 2) fprintf(stderr, "[W::%s] undefined INFO '%s'\n", __func__, key);
+					} else if (excl && excl[id]>>VCF_HL_INFO&1) { // excluded; the value is not looked at
 					} else { // defined in the header
-						uint32_t y = kh_val(d, k).info[VCF_HL_INFO];
+						uint32_t y = ids[id].val->info[VCF_HL_INFO];
 						++v->n_info;
-						vcf_enc_int1(str, kh_val(d, k).id);
+						vcf_enc_int1(str, id);
 						if (val == 0) {
 							vcf_enc_size(str, 0, VCF_BT_NULL);
 						} else if ((y>>4&0xf) == VCF_HT_FLAG || (y>>4&0xf) == VCF_HT_STR) { // if Flag has a value, treat it as a string
@@ -605,99 +1515,173 @@ int vcf_parse1(kstring_t *s, const vcf_hdr_t *h, vcf1_t *v)
 					key = r + 1;
 				}
 			}
+			if (ha->keep && ha->n_keep == 0)
+				break; // sites only; FORMAT and the sample columns are not looked at
 		} else if (i == 8) { // FORMAT
-			int j, l, m, g;
+			int j, l, m, n_cap;
 			ks_tokaux_t aux1;
-			vdict_t *d = (vdict_t*)h->dict[VCF_DT_ID];
+			hdr_aux_t *a = ha;
+			fmt_cache_t *c;
 			char *end = s->s + s->l;
-			// count the number of format fields
-			for (r = p, v->n_fmt = 1; *r; ++r)
-				if (*r == ':') ++v->n_fmt;
-			fmt = (fmt_aux_t*)alloca(v->n_fmt * sizeof(fmt_aux_t));
-			// get format information from the dictionary
-			for (j = 0, t = kstrtok(p, ":", &aux1); t; t = kstrtok(0, 0, &aux1), ++j) {
-				*(char*)aux1.p = 0;
-				k = kh_get(vdict, d, t);
-				if (k == kh_end(d) || kh_val(d, k).info[VCF_HL_FMT] == 15) {
-					if (vcf_verbose >= 2)
-						fprintf(stderr, "[W::%s] FORMAT '%s' is not defined in the header\n", __func__, t);
-					v->n_fmt = 0;
+			if (a->keep) { // move the selected sample columns to the front; the rest are not looked at
+				int l, n_smpl = h->n[VCF_DT_SAMPLE];
+				char *w;
+				for (l = 0, w = r = q + 1; r < end && l < n_smpl; ++l) {
+					if ((t = (char*)memchr(r, '\t', end - r)) == 0) t = end;
+					if (a->keep[l]) {
+						if (w != r) memmove(w, r, t - r);
+						w += t - r;
+						*w++ = '\t';
+					}
+					r = t + 1;
+				}
+				if (w == q + 1) { // no selected columns on this line
+					v->n_sample = 0;
 					break;
-				} else {
-					fmt[j].max_l = fmt[j].max_m = fmt[j].max_g = 0;
-					fmt[j].key = kh_val(d, k).id;
-					fmt[j].is_gt = !strcmp(t, "GT");
-					fmt[j].y = h->id[0][fmt[j].key].val->info[VCF_HL_FMT];
 				}
+				end = w - 1;
+				*end = 0;
+			}
+			for (j = 0; j < FMT_CACHE_SIZE; ++j) { // look up the cache of recent FORMAT strings
+				c = &a->fmt_cache[j];
+				if (c->str.l && q - p == (long)c->str.l && memcmp(p, c->str.s, q - p) == 0) break;
+			}
+			if (j < FMT_CACHE_SIZE) { // a hit; reuse the layout
+				v->n_fmt = c->n_fmt;
+				fmt = (fmt_aux_t*)alloca(v->n_fmt * sizeof(fmt_aux_t));
+				memcpy(fmt, c->fmt, v->n_fmt * sizeof(fmt_aux_t));
+			} else {
+				c = &a->fmt_cache[a->i_fmt_cache];
+				c->str.l = 0;
+				kputsn(p, q - p, &c->str);
+				// count the number of format fields
+				for (r = p, v->n_fmt = 1; *r; ++r)
+					if (*r == ':') ++v->n_fmt;
+				fmt = (fmt_aux_t*)alloca(v->n_fmt * sizeof(fmt_aux_t));
+				// get format information from the dictionary
+				for (j = 0, t = kstrtok(p, ":", &aux1); t; t = kstrtok(0, 0, &aux1), ++j) {
+					int id;
+					*(char*)aux1.p = 0;
+					id = fd_get(ha->fd[VCF_DT_ID], t, aux1.p - t);
+					if (id < 0 || h->id[VCF_DT_ID][id].val->info[VCF_HL_FMT] == 15) {
+						if (vcf_verbose >= 2)
+							fprintf(stderr, "[W::%s] FORMAT '%s' is not defined in the header\n", __func__, t);
+						v->n_fmt = 0;
+						break;
+					} else {
+						fmt[j].key = id;
+						fmt[j].is_gt = !strcmp(t, "GT");
+						fmt[j].is_excl = excl? excl[fmt[j].key]>>VCF_HL_FMT&1 : 0;
+						fmt[j].y = h->id[0][fmt[j].key].val->info[VCF_HL_FMT];
+					}
+				}
+				if (v->n_fmt > 0) { // add to the cache
+					c->n_fmt = v->n_fmt;
+					c->fmt = (fmt_aux_t*)realloc(c->fmt, v->n_fmt * sizeof(fmt_aux_t));
+					memcpy(c->fmt, fmt, v->n_fmt * sizeof(fmt_aux_t));
+					a->i_fmt_cache = (a->i_fmt_cache + 1) % FMT_CACHE_SIZE;
+				} else c->str.l = 0;
 			}
-			// compute max
-			for (r = q + 1, j = 0, m = l = g = 1, v->n_sample = 0;; ++r, ++l) {
-				if (*r == '\t') *r = 0;
-				if (*r == ':' || *r == '\0') { // end of a sample
-					if (fmt[j].max_m < m) fmt[j].max_m = m;
-					if (fmt[j].max_l < l - 1) fmt[j].max_l = l - 1;
-					if (fmt[j].is_gt && fmt[j].max_g < g) fmt[j].max_g = g;
-					l = 0, m = g = 1;
-					if (*r) ++j;
-					else j = 0, ++v->n_sample;
-				} else if (*r == ',') ++m;
-				else if (*r == '|' || *r == '/') ++g;
-				if (r == end) break;
+			if (v->n_fmt == 0 || q == end) break;
+			// resolve the widths: Number in the header if fixed, or the width on the previous line
+			if (a->fmt_w == 0) a->fmt_w = (int32_t*)calloc(h->n[VCF_DT_ID], 4);
+			if (a->m_fbuf < v->n_fmt) {
+				a->fbuf = (kstring_t*)realloc(a->fbuf, v->n_fmt * sizeof(kstring_t));
+				memset(a->fbuf + a->m_fbuf, 0, (v->n_fmt - a->m_fbuf) * sizeof(kstring_t));
+				a->m_fbuf = v->n_fmt;
 			}
-			// allocate memory for arrays
+			n_cap = a->keep? a->n_keep : h->n[VCF_DT_SAMPLE];
+			if (n_cap < 1) n_cap = 1;
 			for (j = 0; j < v->n_fmt; ++j) {
-				fmt_aux_t *f = &fmt[j];
-				if ((f->y>>4&0xf) == VCF_HT_STR) {
-					f->size = f->is_gt? f->max_g << 2 : f->max_l;
-				} else if ((f->y>>4&0xf) == VCF_HT_REAL || (f->y>>4&0xf) == VCF_HT_INT) {
-					f->size = f->max_m << 2;
-				} else abort(); // I do not know how to do with Flag in the genotype fields
-				align_mem(mem);
-				f->offset = mem->l;
-				ks_resize(mem, mem->l + v->n_sample * f->size);
-				mem->l += v->n_sample * f->size;
+				fmt_aux_t *z = &fmt[j];
+				int w, type = z->y>>4&0xf, var = z->y>>8&0xf;
+				if (z->is_excl) continue;
+				if (type != VCF_HT_STR && type != VCF_HT_INT && type != VCF_HT_REAL)
+					abort(); // I do not know how to do with Flag in the genotype fields
+				z->unit = type == VCF_HT_STR && !z->is_gt? 1 : 4;
+				w = a->fmt_w[z->key];
+				if (type != VCF_HT_STR) {
+					if (var == VCF_VL_FIXED) w = z->y>>12;
+					else if (var == VCF_VL_A) w = v->n_allele - 1;
+					else if (var == VCF_VL_G) w = v->n_allele * (v->n_allele + 1) / 2;
+				}
+				z->w = w > 0? w : 1, z->max_n = 0;
+				z->size = z->w * z->unit;
+				z->buf = &a->fbuf[j];
+				ks_resize(z->buf, (size_t)n_cap * z->size);
 			}
-			for (j = 0; j < v->n_fmt; ++j)
-				fmt[j].buf = (uint8_t*)mem->s + fmt[j].offset;
-			// fill the sample fields; at beginning of the loop, t points to the first char of a format
-			for (t = q + 1, j = m = 0;; ++t) { // j: fmt id, m: sample id
+			// fill the sample fields in one pass; at beginning of the loop, t points to the first char of a format
+			for (t = q + 1, j = m = 0;;) { // j: fmt id, m: sample id
 				fmt_aux_t *z = &fmt[j];
-				if ((z->y>>4&0xf) == VCF_HT_STR) {
+				if (j == 0 && m == n_cap) { // more samples than in the header
+					n_cap <<= 1;
+					for (l = 0; l < v->n_fmt; ++l)
+						if (!fmt[l].is_excl) ks_resize(fmt[l].buf, (size_t)n_cap * fmt[l].size);
+				}
+				if (z->is_excl) { // skip without conversion
+					for (; *t != ':' && *t != '\t' && *t; ++t);
+				} else if ((z->y>>4&0xf) == VCF_HT_STR) {
 					if (z->is_gt) { // genotypes
-						int32_t is_phased = 0, *x = (int32_t*)(z->buf + z->size * m);
+						int32_t is_phased = 0, *x = (int32_t*)(z->buf->s + z->size * m);
 						for (l = 0;; ++t) {
+							if (l == z->w) fmt_widen(z, m + 1, n_cap, z->w<<1), x = (int32_t*)(z->buf->s + z->size * m);
 							if (*t == '.') ++t, x[l++] = is_phased;
 							else x[l++] = (strtol(t, &t, 10) + 1) << 1 | is_phased;
 							is_phased = (*t == '|');
-							if (*t == ':' || *t == 0) break;
+							if (*t == ':' || *t == '\t' || *t == 0) break;
 						}
-						for (; l != z->size>>2; ++l) x[l] = INT32_MIN;
+						if (z->max_n < l) z->max_n = l;
+						for (; l != z->w; ++l) x[l] = INT32_MIN;
 					} else {
-						char *x = (char*)z->buf + z->size * m;
-						for (r = t, l = 0; *t != ':' && *t; ++t) x[l++] = *t;
-						for (; l != z->size; ++l) x[l] = 0;
+						char *x = z->buf->s + z->size * m;
+						for (l = 0; *t != ':' && *t != '\t' && *t; ++t) {
+							if (l == z->w) fmt_widen(z, m + 1, n_cap, z->w<<1), x = z->buf->s + z->size * m;
+							x[l++] = *t;
+						}
+						if (z->max_n < l) z->max_n = l;
+						for (; l != z->w; ++l) x[l] = 0;
 					}
 				} else if ((z->y>>4&0xf) == VCF_HT_INT) {
-					int32_t *x = (int32_t*)(z->buf + z->size * m);
+					int32_t *x = (int32_t*)(z->buf->s + z->size * m);
 					for (l = 0;; ++t) {
+						if (l == z->w) fmt_widen(z, m + 1, n_cap, z->w<<1), x = (int32_t*)(z->buf->s + z->size * m);
 						if (*t == '.') x[l++] = INT32_MIN, ++t; // ++t to skip "."
 						else x[l++] = strtol(t, &t, 10);
-						if (*t == ':' || *t == 0) break;
+						if (*t == ':' || *t == '\t' || *t == 0) break;
 					}
-					for (; l != z->size>>2; ++l) x[l] = INT32_MIN;
-				} else if ((z->y>>4&0xf) == VCF_HT_REAL) {
-					float *x = (float*)(z->buf + z->size * m);
+					if (z->max_n < l) z->max_n = l;
+					for (; l != z->w; ++l) x[l] = INT32_MIN;
+				} else {
+					float *x = (float*)(z->buf->s + z->size * m);
 					for (l = 0;; ++t) {
+						if (l == z->w) fmt_widen(z, m + 1, n_cap, z->w<<1), x = (float*)(z->buf->s + z->size * m);
 						if (*t == '.' && !isdigit(t[1])) *(int32_t*)&x[l++] = 0x7F800001, ++t; // ++t to skip "."
 						else x[l++] = strtod(t, &t);
-						if (*t == ':' || *t == 0) break;
+						if (*t == ':' || *t == '\t' || *t == 0) break;
 					}
-					for (; l != z->size>>2; ++l) *(int32_t*)(x+l) = 0x7F800001;
-				} else abort();
-				if (*t == 0) {
-					if (t == end) break;
-					++m, j = 0;
-				} else if (*t == ':') ++j;
+					if (z->max_n < l) z->max_n = l;
+					for (; l != z->w; ++l) *(int32_t*)(x+l) = 0x7F800001;
+				}
+				if (*t == ':' && j + 1 < v->n_fmt) {
+					++t, ++j;
+					continue;
+				}
+				for (; *t != '\t' && *t; ++t); // skip fields not in FORMAT
+				for (++j; j < v->n_fmt; ++j) // fill fields absent from this sample
+					if (!fmt[j].is_excl)
+						fmt_set_missing(&fmt[j], (uint8_t*)fmt[j].buf->s + fmt[j].size * m, 0);
+				++m, j = 0;
+				if (*t == 0) break;
+				++t;
+			}
+			v->n_sample = m;
+			// shrink to the actual widths, which are also the guesses for the next line
+			for (j = 0; j < v->n_fmt; ++j) {
+				fmt_aux_t *z = &fmt[j];
+				if (z->is_excl) continue;
+				if (z->max_n == 0 && z->unit == 4) z->max_n = 1;
+				if (z->max_n < z->w) fmt_shrink(z, m, z->max_n);
+				if (z->max_n > 0) a->fmt_w[z->key] = z->max_n;
 			}
 			break;
 		}
@@ -705,17 +1689,20 @@ int vcf_parse1(kstring_t *s, const vcf_hdr_t *h, vcf1_t *v)
 	// write individual genotype information
 	str = &v->indiv;
 	if (v->n_sample > 0) {
-		for (i = 0; i < v->n_fmt; ++i) {
+		int n_fmt = v->n_fmt;
+		for (i = 0, v->n_fmt = 0; i < n_fmt; ++i) {
 			fmt_aux_t *z = &fmt[i];
+			if (z->is_excl) continue;
+			++v->n_fmt;
 			vcf_enc_int1(str, z->key);
 			if ((z->y>>4&0xf) == VCF_HT_STR && !z->is_gt) {
 				vcf_enc_size(str, z->size, VCF_BT_CHAR);
-				kputsn((char*)z->buf, z->size * v->n_sample, str);
+				kputsn(z->buf->s, z->size * v->n_sample, str);
 			} else if ((z->y>>4&0xf) == VCF_HT_INT || z->is_gt) {
-				vcf_enc_vint(str, (z->size>>2) * v->n_sample, (int32_t*)z->buf, z->size>>2);
+				vcf_enc_vint(str, z->w * v->n_sample, (int32_t*)z->buf->s, z->w);
 			} else {
-				vcf_enc_size(str, z->size>>2, VCF_BT_FLOAT);
-				kputsn((char*)z->buf, z->size * v->n_sample, str);
+				vcf_enc_size(str, z->w, VCF_BT_FLOAT);
+				kputsn(z->buf->s, z->size * v->n_sample, str);
 			}
 		}
 	}
@@ -735,13 +1722,15 @@ int vcf_read1(vcfFile *fp, const vcf_hdr_t *h, vcf1_t *v)
 		ks_resize(&v->indiv, x[1]);
 		memcpy(v, x + 2, 24);
 		v->shared.l = x[0], v->indiv.l = x[1];
+		rec_reset(v);
 		bgzf_read((BGZF*)fp->fp, v->shared.s, v->shared.l);
 		bgzf_read((BGZF*)fp->fp, v->indiv.s, v->indiv.l);
 	} else {
 		int ret, dret;
-		ret = ks_getuntil((kstream_t*)fp->fp, KS_SEP_LINE, &fp->line, &dret);
-		if (ret < 0) return -1;
-		ret = vcf_parse1(&fp->line, h, v);
+		do { // skip lines that cannot be parsed
+			ret = ks_getuntil((kstream_t*)fp->fp, KS_SEP_LINE, &fp->line, &dret);
+			if (ret < 0) return -1;
+		} while (vcf_parse1(&fp->line, h, v) < 0);
 	}
 	return 0;
 }
@@ -860,6 +1849,172 @@ int vcf_write1(vcfFile *fp, const vcf_hdr_t *h, const vcf1_t *v)
 	return 0;
 }
 
+/***********************
+ * BCF concatenation *
+ ***********************/
+
+int vcf_concat_raw(vcfFile *out, vcfFile *in)
+{
+	BGZF *fi = (BGZF*)in->fp, *fo = (BGZF*)out->fp;
+	uint8_t *buf;
+	int ret = 0;
+	if (!in->is_bin || !out->is_bin) return -1;
+	// re-encode the rest of the current block, which is shared with the header
+	if (fi->block_offset < fi->block_length)
+		bgzf_write(fo, (uint8_t*)fi->uncompressed_block + fi->block_offset, fi->block_length - fi->block_offset);
+	if (bgzf_flush(fo) != 0) return -1;
+	// copy the remaining blocks verbatim, dropping empty (EOF marker) blocks
+	buf = (uint8_t*)malloc(BGZF_MAX_BLOCK_SIZE);
+	for (;;) {
+		int n, block_length;
+		if ((n = bgzf_raw_read(fi, buf, 18)) != 18) {
+			if (n != 0) ret = -1;
+			break;
+		}
+		block_length = (buf[16] | buf[17]<<8) + 1;
+		if (block_length < 28 || buf[0] != 31 || buf[1] != 139 || buf[12] != 'B' || buf[13] != 'C') {
+			ret = -1;
+			break;
+		}
+		if (bgzf_raw_read(fi, buf + 18, block_length - 18) != block_length - 18) {
+			ret = -1;
+			break;
+		}
+		if (*(uint32_t*)(buf + block_length - 4) == 0) continue; // ISIZE==0: an empty block
+		if (bgzf_raw_write(fo, buf, block_length) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	free(buf);
+	fi->block_offset = fi->block_length = 0;
+	if (ret < 0 && vcf_verbose >= 1)
+		fprintf(stderr, "[E::%s] truncated or corrupted BGZF block\n", __func__);
+	return ret;
+}
+
+/*************************
+ * Record ID translation *
+ *************************/
+
+int vcf_translate(const int *ctg_map, const int *id_map, vcf1_t *v, kstring_t *tmp)
+{
+	uint8_t *ptr, *end;
+	int i, ret = 0;
+	kstring_t t;
+	if (ctg_map) {
+		if (ctg_map[v->rid] < 0) return -1;
+		v->rid = ctg_map[v->rid];
+	}
+	if (id_map == 0) return 0;
+	rec_reset(v);
+	// shared: ID and alleles are copied as they are
+	tmp->l = 0;
+	ptr = (uint8_t*)v->shared.s;
+	end = vcf_skip_typed(ptr);
+	for (i = 0; i < v->n_allele; ++i) end = vcf_skip_typed(end);
+	kputsn((char*)ptr, end - ptr, tmp);
+	ptr = end;
+	{ // FILTER
+		int32_t n, *a, type;
+		n = vcf_dec_size(ptr, &ptr, &type);
+		a = (int32_t*)alloca((n + 1) * 4);
+		for (i = 0; i < n; ++i)
+			if ((a[i] = id_map[vcf_dec_int1(ptr, type, &ptr)]) < 0) ret = -1;
+		vcf_enc_vint(tmp, n, a, -1);
+	}
+	for (i = 0; i < (int)v->n_info; ++i) { // INFO
+		int32_t x = id_map[vcf_dec_typed_int1(ptr, &ptr)];
+		if (x < 0) ret = -1;
+		vcf_enc_int1(tmp, x);
+		end = vcf_skip_typed(ptr);
+		kputsn((char*)ptr, end - ptr, tmp);
+		ptr = end;
+	}
+	t = v->shared; v->shared = *tmp; *tmp = t;
+	// indiv: only the FORMAT keys are changed
+	tmp->l = 0;
+	ptr = (uint8_t*)v->indiv.s;
+	for (i = 0; i < (int)v->n_fmt; ++i) {
+		int32_t n, x = id_map[vcf_dec_typed_int1(ptr, &ptr)];
+		int type;
+		if (x < 0) ret = -1;
+		vcf_enc_int1(tmp, x);
+		n = vcf_dec_size(ptr, &end, &type);
+		end += v->n_sample * (n << vcf_type_shift[type]);
+		kputsn((char*)ptr, end - ptr, tmp);
+		ptr = end;
+	}
+	t = v->indiv; v->indiv = *tmp; *tmp = t;
+	return ret;
+}
+
+/*********************
+ * Sample subsetting *
+ *********************/
+
+void vcf_subset_samples(vcf1_t *v, int n, const int *imap)
+{
+	uint8_t *src, *dst;
+	int i, j, k;
+	if (n == v->n_sample) return;
+	// as imap[] is ascending, the output never overtakes the input
+	src = dst = (uint8_t*)v->indiv.s;
+	for (i = 0; i < (int)v->n_fmt; ++i) {
+		uint8_t *p = src;
+		int32_t size, type;
+		vcf_dec_typed_int1(src, &src);
+		size = vcf_dec_size(src, &src, &type) << vcf_type_shift[type];
+		memmove(dst, p, src - p);
+		dst += src - p;
+		for (j = 0; j < n; j = k) { // copy runs of consecutive samples
+			for (k = j + 1; k < n && imap[k] == imap[k-1] + 1; ++k);
+			memmove(dst, src + imap[j] * size, (k - j) * size);
+			dst += (k - j) * size;
+		}
+		src += v->n_sample * size;
+	}
+	v->indiv.l = dst - (uint8_t*)v->indiv.s;
+	v->n_sample = n;
+	if (n == 0) v->n_fmt = 0, v->indiv.l = 0;
+}
+
+void vcf_exclude_fields(const vcf_hdr_t *h, vcf1_t *v)
+{
+	uint8_t *src, *dst, *end, *excl;
+	int i, n;
+	if (h->aux == 0 || (excl = ((hdr_aux_t*)h->aux)->excl) == 0) return;
+	rec_reset(v);
+	// shared: skip ID, alleles and FILTER, then compact the INFO fields
+	src = vcf_skip_typed((uint8_t*)v->shared.s);
+	for (i = 0; i < v->n_allele; ++i) src = vcf_skip_typed(src);
+	dst = src = vcf_skip_typed(src);
+	for (i = n = 0; i < (int)v->n_info; ++i) {
+		uint8_t *p = src;
+		int32_t id = vcf_dec_typed_int1(src, &src);
+		src = vcf_skip_typed(src);
+		if ((excl[id]>>VCF_HL_INFO | excl[id]>>(VCF_HL_INFO+EXCL_LATE))&1) continue;
+		if (dst != p) memmove(dst, p, src - p);
+		dst += src - p, ++n;
+	}
+	v->shared.l = dst - (uint8_t*)v->shared.s;
+	v->n_info = n;
+	// indiv
+	dst = src = (uint8_t*)v->indiv.s;
+	for (i = n = 0; i < (int)v->n_fmt; ++i) {
+		uint8_t *p = src;
+		int32_t id, x, type;
+		id = vcf_dec_typed_int1(src, &src);
+		x = vcf_dec_size(src, &end, &type);
+		src = end + v->n_sample * (x << vcf_type_shift[type]);
+		if ((excl[id]>>VCF_HL_FMT | excl[id]>>(VCF_HL_FMT+EXCL_LATE))&1) continue;
+		if (dst != p) memmove(dst, p, src - p);
+		dst += src - p, ++n;
+	}
+	v->indiv.l = dst - (uint8_t*)v->indiv.s;
+	v->n_fmt = n;
+}
+
 /************************
  * Data access routines *
  ************************/
@@ -868,6 +2023,19 @@ int vcf_id2int(const vcf_hdr_t *h, int which, const char *id)
 {
 	khint_t k;
 	vdict_t *d = (vdict_t*)h->dict[which];
+	hdr_aux_t *a = (hdr_aux_t*)h->aux;
+	if (which == VCF_DT_SAMPLE) {
+		if (a == 0) return -1;
+		if (a->fd[which] == 0) { // build the sample table on the first lookup
+			int i;
+			a->fd[which] = fd_build(a->n_smpl, a->smpl);
+			for (i = 0; i < a->n_smpl; ++i)
+				if (fd_get(a->fd[which], a->smpl[i], strlen(a->smpl[i])) != i && vcf_verbose >= 2)
+					fprintf(stderr, "[W::%s] Duplicated sample name '%s'\n", __func__, a->smpl[i]);
+		}
+	}
+	if (a && a->fd[which])
+		return fd_get(a->fd[which], id, strlen(id));
 	k = kh_get(vdict, d, id);
 	return k == kh_end(d)? -1 : kh_val(d, k).id;
 }
@@ -880,3 +2048,377 @@ vcf_fmt_t *vcf_unpack_fmt(const vcf_hdr_t *h, const vcf1_t *v)
 	vcf_unpack_fmt_core((uint8_t*)v->indiv.s, v->n_sample, v->n_fmt, fmt);
 	return fmt;
 }
+
+// locate FORMAT field _id_ in a record; return NULL if absent
+static const uint8_t *fmt_locate(const vcf1_t *v, int id, int *n, int *type)
+{
+	uint8_t *p = (uint8_t*)v->indiv.s;
+	int i;
+	for (i = 0; i < (int)v->n_fmt; ++i) {
+		int key = vcf_dec_typed_int1(p, &p);
+		*n = vcf_dec_size(p, &p, type);
+		if (key == id) return p;
+		p += (size_t)v->n_sample * (*n << vcf_type_shift[*type]);
+	}
+	return 0;
+}
+
+#ifdef __SSE2__
+// sign-extend eight int16 in _y_ to int32 and store them; lanes set in _m_ become INT32_MIN
+static inline void mm_widen_store(int32_t *dst, __m128i y, __m128i m)
+{
+	__m128i miss = _mm_set1_epi32(INT32_MIN), z, k;
+	z = _mm_srai_epi32(_mm_unpacklo_epi16(y, y), 16);
+	k = _mm_unpacklo_epi16(m, m);
+	_mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_andnot_si128(k, z), _mm_and_si128(k, miss)));
+	z = _mm_srai_epi32(_mm_unpackhi_epi16(y, y), 16);
+	k = _mm_unpackhi_epi16(m, m);
+	_mm_storeu_si128((__m128i*)(dst + 4), _mm_or_si128(_mm_andnot_si128(k, z), _mm_and_si128(k, miss)));
+}
+#endif
+
+// widen int8 or int16 to int32, mapping INT8_MIN/INT16_MIN to INT32_MIN
+static void vint_widen(int n, int type, const uint8_t *src, int32_t *dst)
+{
+	int i = 0;
+	if (type == VCF_BT_INT8) {
+#ifdef __SSE2__
+		__m128i m8 = _mm_set1_epi8(INT8_MIN);
+		for (; i + 16 <= n; i += 16) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i m = _mm_cmpeq_epi8(x, m8);
+			mm_widen_store(dst + i,     _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8), _mm_unpacklo_epi8(m, m));
+			mm_widen_store(dst + i + 8, _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8), _mm_unpackhi_epi8(m, m));
+		}
+#endif
+		for (; i < n; ++i)
+			dst[i] = (int8_t)src[i] == INT8_MIN? INT32_MIN : (int8_t)src[i];
+	} else {
+#ifdef __SSE2__
+		__m128i m16 = _mm_set1_epi16(INT16_MIN);
+		for (; i + 8 <= n; i += 8) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(src + i * 2));
+			mm_widen_store(dst + i, x, _mm_cmpeq_epi16(x, m16));
+		}
+#endif
+		for (; i < n; ++i) {
+			int16_t x;
+			memcpy(&x, src + i * 2, 2);
+			dst[i] = x == INT16_MIN? INT32_MIN : x;
+		}
+	}
+}
+
+static const uint8_t *fmt_get(const vcf_hdr_t *h, const vcf1_t *v, const char *key, int *n, int *type)
+{
+	int id = vcf_id2int(h, VCF_DT_ID, key);
+	if (id < 0 || h->id[VCF_DT_ID][id].val->info[VCF_HL_FMT] == 15) return 0;
+	return fmt_locate(v, id, n, type);
+}
+
+int vcf_get_format_int32(const vcf_hdr_t *h, const vcf1_t *v, const char *key, int32_t **dst, int *ndst)
+{
+	const uint8_t *p;
+	int n, type, n_tot;
+	if ((p = fmt_get(h, v, key, &n, &type)) == 0) return -1;
+	if (type != VCF_BT_INT8 && type != VCF_BT_INT16 && type != VCF_BT_INT32) return -2;
+	n_tot = n * v->n_sample;
+	if (n_tot > *ndst) {
+		*ndst = n_tot;
+		kroundup32(*ndst);
+		*dst = (int32_t*)realloc(*dst, *ndst * sizeof(int32_t));
+	}
+	if (type == VCF_BT_INT32) memcpy(*dst, p, n_tot * 4);
+	else vint_widen(n_tot, type, p, *dst);
+	return n_tot;
+}
+
+int vcf_get_format_float(const vcf_hdr_t *h, const vcf1_t *v, const char *key, float **dst, int *ndst)
+{
+	const uint8_t *p;
+	int n, type, n_tot;
+	if ((p = fmt_get(h, v, key, &n, &type)) == 0) return -1;
+	if (type != VCF_BT_FLOAT) return -2;
+	n_tot = n * v->n_sample;
+	if (n_tot > *ndst) {
+		*ndst = n_tot;
+		kroundup32(*ndst);
+		*dst = (float*)realloc(*dst, *ndst * sizeof(float));
+	}
+	memcpy(*dst, p, n_tot * 4);
+	return n_tot;
+}
+
+int vcf_set_gt_missing(const vcf_hdr_t *h, vcf1_t *v, const uint8_t *mask)
+{
+	uint8_t *p;
+	int i, j, n, type, gt, cnt = 0;
+	if ((gt = vcf_id2int(h, VCF_DT_ID, "GT")) < 0) return 0;
+	if ((p = (uint8_t*)fmt_locate(v, gt, &n, &type)) == 0) return 0;
+	for (i = 0; i < v->n_sample; ++i) { // keep the phasing bit and the vector end
+		if (!mask[i]) continue;
+		++cnt;
+		if (type == VCF_BT_INT8) {
+			int8_t *x = (int8_t*)p + i * n;
+			for (j = 0; j < n && x[j] != INT8_MIN; ++j) x[j] &= 1;
+		} else if (type == VCF_BT_INT16) {
+			int16_t *x = (int16_t*)p + i * n;
+			for (j = 0; j < n && x[j] != INT16_MIN; ++j) x[j] &= 1;
+		} else if (type == VCF_BT_INT32) {
+			int32_t *x = (int32_t*)p + i * n;
+			for (j = 0; j < n && x[j] != INT32_MIN; ++j) x[j] &= 1;
+		}
+	}
+	return cnt;
+}
+
+#ifdef __SSE2__
+static inline uint64_t mm_hsum_epu8(__m128i x) // sum of 16 unsigned bytes
+{
+	x = _mm_sad_epu8(x, _mm_setzero_si128());
+	return (uint64_t)_mm_cvtsi128_si32(x) + _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+}
+#endif
+
+// count alleles 0 and 1 in an int8 GT array; 0/1 (missing) and INT8_MIN (vector end) are skipped
+static void gt_count2_int8(int n, const int8_t *p, int32_t *ac)
+{
+	int i = 0;
+#ifdef __SSE2__
+	__m128i mask = _mm_set1_epi8((char)0xfe), a0 = _mm_set1_epi8(2), a1 = _mm_set1_epi8(4);
+	while (i + 16 <= n) {
+		__m128i c0 = _mm_setzero_si128(), c1 = _mm_setzero_si128();
+		int j;
+		for (j = 0; j < 255 && i + 16 <= n; ++j, i += 16) { // byte counters overflow after 255 rounds
+			__m128i x = _mm_and_si128(_mm_loadu_si128((const __m128i*)(p + i)), mask);
+			c0 = _mm_sub_epi8(c0, _mm_cmpeq_epi8(x, a0));
+			c1 = _mm_sub_epi8(c1, _mm_cmpeq_epi8(x, a1));
+		}
+		ac[0] += mm_hsum_epu8(c0);
+		ac[1] += mm_hsum_epu8(c1);
+	}
+#endif
+	for (; i < n; ++i) {
+		if ((p[i]>>1) == 1) ++ac[0];
+		else if ((p[i]>>1) == 2) ++ac[1];
+	}
+}
+
+int vcf_count_alleles(const vcf_hdr_t *h, const vcf1_t *v, int32_t **ac, int *m_ac)
+{
+	const uint8_t *p;
+	int i, n, type, gt, n_tot, an;
+	if ((gt = vcf_id2int(h, VCF_DT_ID, "GT")) < 0) return -1;
+	if ((p = fmt_locate(v, gt, &n, &type)) == 0) return -1;
+	if (v->n_allele > *m_ac) {
+		*m_ac = v->n_allele;
+		kroundup32(*m_ac);
+		*ac = (int32_t*)realloc(*ac, *m_ac * sizeof(int32_t));
+	}
+	memset(*ac, 0, v->n_allele * sizeof(int32_t));
+	n_tot = n * v->n_sample; // any ploidy: the vector end is skipped like a missing allele
+	if (type == VCF_BT_INT8 && v->n_allele == 2) gt_count2_int8(n_tot, (const int8_t*)p, *ac);
+	else {
+		for (i = 0; i < n_tot; ++i) {
+			int32_t x;
+			if (type == VCF_BT_INT8) x = ((const int8_t*)p)[i];
+			else if (type == VCF_BT_INT16) {
+				int16_t y;
+				memcpy(&y, p + i * 2, 2);
+				x = y;
+			} else if (type == VCF_BT_INT32) memcpy(&x, p + i * 4, 4);
+			else return -1;
+			x = (x >> 1) - 1; // negative for missing and the vector end
+			if (x >= 0 && x < v->n_allele) ++(*ac)[x];
+		}
+	}
+	for (i = an = 0; i < v->n_allele; ++i) an += (*ac)[i];
+	return an;
+}
+
+static inline int gt_code2(const int32_t *x, int w) // the 2-bit dosage code of one sample; see vcf_pack_gt2()
+{
+	int j, d = 0;
+	for (j = 0; j < w && x[j] != INT32_MIN; ++j) {
+		if (x[j]>>1 == 0) return 3;
+		d += x[j]>>1 > 1;
+	}
+	return j == 0? 3 : d < 2? d : 2;
+}
+
+#ifdef __SSE2__
+// 16 diploid int8 genotypes to 16 codes, one per byte
+static inline __m128i gt_code2_diploid8(const int8_t *p)
+{
+	__m128i lo = _mm_set1_epi16(0xfe), ref = _mm_set1_epi16(2), pad = _mm_set1_epi16(0x80), zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+	__m128i c[2];
+	int k;
+	for (k = 0; k < 2; ++k) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(p + k * 16));
+		__m128i a = _mm_and_si128(x, lo), b = _mm_and_si128(_mm_srli_epi16(x, 8), lo), b_pad, miss;
+		b_pad = _mm_cmpeq_epi16(b, pad); // a haploid call: only the first allele counts
+		miss = _mm_or_si128(_mm_cmpeq_epi16(a, zero), _mm_andnot_si128(b_pad, _mm_cmpeq_epi16(b, zero)));
+		miss = _mm_or_si128(miss, _mm_cmpeq_epi16(a, pad)); // no GT at all, as when trailing fields are dropped
+		c[k] = _mm_add_epi16(_mm_andnot_si128(_mm_cmpeq_epi16(a, ref), one), _mm_andnot_si128(_mm_or_si128(b_pad, _mm_cmpeq_epi16(b, ref)), one));
+		c[k] = _mm_or_si128(_mm_andnot_si128(miss, c[k]), _mm_and_si128(miss, _mm_set1_epi16(3)));
+	}
+	return _mm_packus_epi16(c[0], c[1]);
+}
+#endif
+
+static inline uint32_t code2_pack4x2(uint64_t x) // 8 codes, one per byte, to 2 bytes
+{
+	x = (x | x >> 6) & 0x000F000F000F000FULL;
+	x = (x | x >> 12) & 0x000000FF000000FFULL;
+	return (uint32_t)((x | x >> 24) & 0xFFFF);
+}
+
+static inline int gt_code2_at(const uint8_t *p, int type, int n, int i) // the code of sample i; -1 for a non-integer type
+{
+	int32_t x[8];
+	int j;
+	for (j = 0; j < n; ++j) {
+		if (type == VCF_BT_INT8) {
+			int8_t y = ((const int8_t*)p)[i * n + j];
+			x[j] = y == INT8_MIN? INT32_MIN : y;
+		} else if (type == VCF_BT_INT16) {
+			int16_t y;
+			memcpy(&y, p + (i * n + j) * 2, 2);
+			x[j] = y == INT16_MIN? INT32_MIN : y;
+		} else if (type == VCF_BT_INT32) memcpy(&x[j], p + (i * n + j) * 4, 4);
+		else return -1;
+	}
+	return gt_code2(x, n);
+}
+
+int vcf_pack_gt2(const vcf_hdr_t *h, const vcf1_t *v, uint8_t *dst)
+{
+	const uint8_t *p;
+	int i = 0, n, type, gt, c;
+	memset(dst, 0xff, (v->n_sample + 3) >> 2);
+	if ((gt = vcf_id2int(h, VCF_DT_ID, "GT")) < 0) return -1;
+	if ((p = fmt_locate(v, gt, &n, &type)) == 0) return -1;
+	if (n > 8) return -1;
+#ifdef __SSE2__
+	if (type == VCF_BT_INT8 && n == 2) {
+		for (; i + 16 <= v->n_sample; i += 16) {
+			uint64_t c[2];
+			uint32_t y;
+			_mm_storeu_si128((__m128i*)c, gt_code2_diploid8((const int8_t*)p + i * 2));
+			y = code2_pack4x2(c[0]) | code2_pack4x2(c[1]) << 16;
+			memcpy(dst + (i >> 2), &y, 4);
+		}
+	}
+#endif
+	for (; i < v->n_sample; ++i) {
+		if ((c = gt_code2_at(p, type, n, i)) < 0) return -1;
+		dst[i>>2] &= ~(3 << (i&3)*2);
+		dst[i>>2] |= c << (i&3)*2;
+	}
+	return 0;
+}
+
+static inline void carrier_push(uint32_t **c, int *m_c, int k, uint32_t x)
+{
+	if (k == *m_c) {
+		*m_c = *m_c? *m_c<<1 : 16;
+		*c = (uint32_t*)realloc(*c, *m_c * 4);
+	}
+	(*c)[k] = x;
+}
+
+int vcf_get_carriers(const vcf_hdr_t *h, const vcf1_t *v, uint32_t **c, int *m_c)
+{
+	const uint8_t *p;
+	int i = 0, k = 0, n, type, gt, code;
+	if ((gt = vcf_id2int(h, VCF_DT_ID, "GT")) < 0) return -1;
+	if ((p = fmt_locate(v, gt, &n, &type)) == 0 || n > 8) return -1;
+#ifdef __SSE2__
+	if (type == VCF_BT_INT8 && n == 2) {
+		__m128i lo = _mm_set1_epi16((short)0xfefe), ref = _mm_set1_epi16(0x0202), hap = _mm_set1_epi16((short)0x8002);
+		for (; i + 32 <= v->n_sample; i += 32) { // 32 samples at a time; at rare sites, nearly all blocks are hom-ref and skipped
+			__m128i r[4];
+			uint32_t m;
+			int b;
+			for (b = 0; b < 4; ++b) {
+				__m128i x = _mm_and_si128(_mm_loadu_si128((const __m128i*)(p + i * 2 + b * 16)), lo);
+				r[b] = _mm_or_si128(_mm_cmpeq_epi16(x, ref), _mm_cmpeq_epi16(x, hap)); // 0/0 or haploid 0
+			}
+			m = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(r[0], r[1])) | (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(r[2], r[3])) << 16;
+			for (m = ~m; m; m &= m - 1) {
+				int j = i + __builtin_ctz(m);
+				carrier_push(c, m_c, k++, (uint32_t)j << 2 | gt_code2_at(p, type, n, j));
+			}
+		}
+	}
+#endif
+	for (; i < v->n_sample; ++i) {
+		if ((code = gt_code2_at(p, type, n, i)) < 0) return -1;
+		if (code) carrier_push(c, m_c, k++, (uint32_t)i << 2 | code);
+	}
+	return k;
+}
+
+static void info_build(const vcf_hdr_t *h, vcf1_t *v)
+{
+	rec_aux_t *a;
+	uint8_t *p;
+	int i;
+	if (v->aux == 0) v->aux = calloc(1, sizeof(rec_aux_t));
+	a = (rec_aux_t*)v->aux;
+	if (a->m_info < h->n[VCF_DT_ID]) {
+		a->m_info = h->n[VCF_DT_ID];
+		a->info_gen = (uint32_t*)realloc(a->info_gen, a->m_info * 4);
+		a->info_off = (int32_t*)realloc(a->info_off, a->m_info * 4);
+		memset(a->info_gen, 0, a->m_info * 4);
+		a->gen = 0;
+	}
+	if (++a->gen == 0) { // wrapped around
+		memset(a->info_gen, 0, a->m_info * 4);
+		a->gen = 1;
+	}
+	p = vcf_skip_typed((uint8_t*)v->shared.s); // ID
+	for (i = 0; i < v->n_allele; ++i) p = vcf_skip_typed(p);
+	p = vcf_skip_typed(p); // FILTER
+	for (i = 0; i < (int)v->n_info; ++i) {
+		int id = vcf_dec_typed_int1(p, &p);
+		if (id >= 0 && id < a->m_info) {
+			a->info_gen[id] = a->gen;
+			a->info_off[id] = p - (uint8_t*)v->shared.s;
+		}
+		p = vcf_skip_typed(p);
+	}
+	a->is_built = 1;
+}
+
+uint8_t *vcf_get_info_ptr(const vcf_hdr_t *h, vcf1_t *v, int id)
+{
+	rec_aux_t *a = (rec_aux_t*)v->aux;
+	if (a == 0 || !a->is_built) info_build(h, v), a = (rec_aux_t*)v->aux;
+	if (id < 0 || id >= a->m_info || a->info_gen[id] != a->gen) return 0;
+	return (uint8_t*)v->shared.s + a->info_off[id];
+}
+
+int vcf_get_info_values(const vcf_hdr_t *h, vcf1_t *v, const char *key, void **dst, int *ndst, int type)
+{
+	uint8_t *p;
+	int id, n, t, size;
+	id = vcf_id2int(h, VCF_DT_ID, key);
+	if (id < 0 || h->id[VCF_DT_ID][id].val->info[VCF_HL_INFO] == 15) return -1;
+	if ((p = vcf_get_info_ptr(h, v, id)) == 0) return type == VCF_HT_FLAG? 0 : -1;
+	if (type == VCF_HT_FLAG) return 1;
+	n = vcf_dec_size(p, &p, &t);
+	if (type == VCF_HT_INT && (t == VCF_BT_INT8 || t == VCF_BT_INT16 || t == VCF_BT_INT32)) size = 4;
+	else if (type == VCF_HT_REAL && t == VCF_BT_FLOAT) size = 4;
+	else if (type == VCF_HT_STR && t == VCF_BT_CHAR) size = 1;
+	else return -2;
+	if (n + 1 > *ndst) { // +1 for the NULL terminator of strings
+		*ndst = n + 1;
+		kroundup32(*ndst);
+		*dst = realloc(*dst, *ndst * size);
+	}
+	if (t == VCF_BT_INT8 || t == VCF_BT_INT16) vint_widen(n, t, p, (int32_t*)*dst);
+	else memcpy(*dst, p, n * size);
+	if (t == VCF_BT_CHAR) ((char*)*dst)[n] = 0;
+	return n;
+}
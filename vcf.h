@@ -25,6 +25,7 @@ typedef struct {
 	uint32_t is_bin:1, is_write:1, dummy:30;
 	kstring_t line;
 	char *fn_ref; // external reference sequence dictionary
+	char *fn; // file name of BCF input; used to find the .hdx header cache
 	void *fp; // file pointer; actual type depending on is_bin and is_write
 } vcfFile;
 
@@ -57,6 +58,10 @@ typedef struct {
    vcf_idinfo_t struct. vcf_hdr_t::id[] points to key-value pairs in the hash
    table in the order that they appear in the VCF header. vcf_hdr_t::n[] is the
    size of the hash table or, equivalently, the length of the id[] arrays.
+
+   Samples are the exception: dict[VCF_DT_SAMPLE] stays empty and id[] lists
+   every sample column of the "#CHROM" line, duplicated names included, so
+   that n[VCF_DT_SAMPLE] always equals the number of samples in a record.
 */
 
 #define VCF_DT_ID		0 // dictionary type
@@ -79,8 +84,10 @@ typedef struct {
 	void *dict[3]; // ID dictionary, contig dict and sample dict
 	char *text;
 	kstring_t mem;
+	void *aux; // auxiliary data for parsing; opaque to the end users
 } vcf_hdr_t;
 
+extern int vcf_verbose;
 extern uint8_t vcf_type_shift[];
 
 /**************
@@ -102,6 +109,7 @@ typedef struct {
 	uint32_t n_info:16, n_allele:16;
 	uint32_t n_fmt:8, n_sample:24;
 	kstring_t shared, indiv;
+	void *aux; // lookup tables built on demand; opaque to the end users
 } vcf1_t;
 
 typedef struct {
@@ -109,6 +117,10 @@ typedef struct {
 	uint8_t *p;
 } vcf_fmt_t;
 
+typedef struct vcf_cix_t vcf_cix_t; // carrier index; see vcf_cix_build()
+
+#define VCF_SIDECAR_HDR 32 // magic, 4 reserved bytes and the vcf_file_key() of the BCF
+
 /*******
  * API *
  *******/
@@ -119,9 +131,85 @@ extern "C" {
 
 	vcfFile *vcf_open(const char *fn, const char *mode, const char *fn_ref);
 	void vcf_close(vcfFile *fp);
+
+	/** Virtual offset of the next record of a BCF (see bgzf_tell()); -1 for VCF */
+	int64_t vcf_tell(const vcfFile *fp);
+
+	/** Move a BCF opened for reading to a virtual offset; 0 on success and -1 otherwise */
+	int vcf_seek(vcfFile *fp, int64_t voff);
+
 	vcf_hdr_t *vcf_hdr_read(vcfFile *fp);
 	void vcf_hdr_write(vcfFile *fp, const vcf_hdr_t *h);
 	void vcf_hdr_destroy(vcf_hdr_t *h);
+	int vcf_hdr_compat(const vcf_hdr_t *h0, const vcf_hdr_t *h1);
+
+	/**
+	 * Write the dictionaries of a BCF header to "fn.hdx".
+	 *
+	 * If the cache exists and matches the header text, vcf_hdr_read() maps it
+	 * instead of parsing the header.
+	 *
+	 * @return 0 on success; -1 on I/O errors
+	 */
+	int vcf_hdr_cache_save(const vcf_hdr_t *h, const char *fn);
+
+	/**
+	 * Merge the dictionaries of multiple headers.
+	 *
+	 * Header lines of h[0] are kept in order; FILTER/INFO/FORMAT/contig lines
+	 * of other headers are appended if their IDs are absent. All headers must
+	 * have the same samples in the same order.
+	 *
+	 * @return the merged header; 0 if samples differ
+	 */
+	vcf_hdr_t *vcf_hdr_merge(int n, vcf_hdr_t *const *h);
+
+	/**
+	 * Map the IDs in dictionary _which_ of _src_ to those of _dst_.
+	 *
+	 * @return malloc'd array of size src->n[which], with -1 for absent IDs, or
+	 *         0 if the mapping is the identity
+	 */
+	int *vcf_hdr_idmap(const vcf_hdr_t *dst, const vcf_hdr_t *src, int which);
+
+	/**
+	 * Create a header keeping a subset of samples.
+	 *
+	 * Samples are kept in their original order; absent names are skipped
+	 * with a warning. Other dictionaries are identical to those of _h0_.
+	 *
+	 * @param imap  output; imap[i] is the index in _h0_ of the i-th sample
+	 *              kept; must hold at least _n_ elements
+	 * @return the new header; its n[VCF_DT_SAMPLE] gives the size of imap
+	 */
+	vcf_hdr_t *vcf_hdr_subset(const vcf_hdr_t *h0, int n, char *const *samples, int *imap);
+
+	/**
+	 * Let vcf_parse1() keep only a subset of sample columns.
+	 *
+	 * Unselected columns are skipped without being converted. The header
+	 * describing the parsed records is given by vcf_hdr_subset().
+	 *
+	 * @param n     number of samples to keep; negative to keep all
+	 * @param imap  indices of the samples to keep
+	 */
+	void vcf_hdr_set_samples(vcf_hdr_t *h, int n, const int *imap);
+
+	/**
+	 * Let vcf_parse1() drop an INFO or FORMAT field.
+	 *
+	 * Values of excluded fields are skipped without conversion or encoding.
+	 *
+	 * @param type  VCF_HL_INFO or VCF_HL_FMT
+	 * @return 0 on success; -1 if the field is not defined in the header
+	 */
+	int vcf_hdr_exclude(vcf_hdr_t *h, int type, const char *key);
+
+	/**
+	 * Like vcf_hdr_exclude(), but vcf_parse1() keeps the field and only
+	 * vcf_exclude_fields() drops it, so that a filter can still read it.
+	 */
+	int vcf_hdr_exclude_late(vcf_hdr_t *h, int type, const char *key);
 
 	vcf1_t *vcf_init1(void);
 	void vcf_destroy1(vcf1_t *v);
@@ -129,8 +217,218 @@ extern "C" {
 	int vcf_format1(const vcf_hdr_t *h, const vcf1_t *v, kstring_t *s);
 	int vcf_write1(vcfFile *fp, const vcf_hdr_t *h, const vcf1_t *v);
 
+	/**
+	 * Append the records of a BCF to another BCF without recompression.
+	 *
+	 * The header of _in_ must have been read and that of _out_ written. The
+	 * rest of the block holding the header end is re-encoded; the following
+	 * BGZF blocks are copied verbatim, with EOF markers stripped. The caller
+	 * is responsible for checking header compatibility with vcf_hdr_compat().
+	 *
+	 * @return 0 on success; negative on error
+	 */
+	int vcf_concat_raw(vcfFile *out, vcfFile *in);
+
+	/**
+	 * Get the index of _id_ in dictionary _which_; -1 if absent.
+	 *
+	 * For a sample name that appears more than once, the first of its
+	 * columns is returned; the first lookup warns about such names.
+	 */
 	int vcf_id2int(const vcf_hdr_t *h, int which, const char *id);
+
+	/**
+	 * Rewrite CHROM and FILTER/INFO/FORMAT IDs in the typed bytes of a record.
+	 *
+	 * @param ctg_map  contig ID map from vcf_hdr_idmap(); 0 for identity
+	 * @param id_map   FILTER/INFO/FORMAT ID map from vcf_hdr_idmap(); 0 for identity
+	 * @param tmp      temporary buffer, swapped with v->shared and v->indiv
+	 * @return 0 on success; -1 if an ID is absent from the destination
+	 */
+	int vcf_translate(const int *ctg_map, const int *id_map, vcf1_t *v, kstring_t *tmp);
+
+	/**
+	 * Keep a subset of samples in a record, in place.
+	 *
+	 * @param n     number of samples to keep
+	 * @param imap  indices of the samples to keep, in ascending order, as
+	 *              computed by vcf_hdr_subset()
+	 */
+	void vcf_subset_samples(vcf1_t *v, int n, const int *imap);
+
+	/**
+	 * Drop fields excluded by vcf_hdr_exclude() or vcf_hdr_exclude_late()
+	 * from a record, in place. This is only necessary for records not parsed
+	 * by vcf_parse1() or with fields excluded late.
+	 */
+	void vcf_exclude_fields(const vcf_hdr_t *h, vcf1_t *v);
+	/** Invalidate the lookup tables of _v_ after rewriting vcf1_t::shared */
+	void vcf_aux_reset(vcf1_t *v);
+
+	/** Append _n_ values of BCF type _type_ as VCF text; '.' if all missing */
+	void vcf_fmt_array(kstring_t *s, int n, int type, void *data);
+
+	/** Append a typed array as VCF text; @return pointer past the array */
+	uint8_t *vcf_fmt_sized_array(kstring_t *s, uint8_t *ptr);
+
 	vcf_fmt_t *vcf_unpack_fmt(const vcf_hdr_t *h, const vcf1_t *v);
+	uint8_t *vcf_unpack_fmt_core(uint8_t *ptr, int n_sample, int n_fmt, vcf_fmt_t *fmt);
+
+	/**
+	 * Extract a FORMAT field as an int32_t array.
+	 *
+	 * Values are stored sample by sample, n_sample*(return value/n_sample)
+	 * in total. int8/int16 values are widened and their missing values are
+	 * translated to INT32_MIN.
+	 *
+	 * @param key   FORMAT ID, e.g. "AD"
+	 * @param dst   buffer, reallocated if shorter than needed
+	 * @param ndst  capacity of *dst, updated on reallocation
+	 *
+	 * @return number of values written; -1 if _key_ is absent from the
+	 *         header or from the record; -2 if the field is not an integer
+	 */
+	int vcf_get_format_int32(const vcf_hdr_t *h, const vcf1_t *v, const char *key, int32_t **dst, int *ndst);
+
+	/** Extract a Float FORMAT field; see vcf_get_format_int32() */
+	int vcf_get_format_float(const vcf_hdr_t *h, const vcf1_t *v, const char *key, float **dst, int *ndst);
+
+	/**
+	 * Set the genotypes of samples with mask[i] set to missing, in place.
+	 *
+	 * @return number of samples masked; 0 if the record has no GT
+	 */
+	int vcf_set_gt_missing(const vcf_hdr_t *h, vcf1_t *v, const uint8_t *mask);
+
+	/**
+	 * Count the alleles in GT, for any number of alleles and any ploidy.
+	 *
+	 * @param ac    (*ac)[i] is set to the count of allele i, REF included;
+	 *              reallocated if shorter than n_allele
+	 * @param m_ac  capacity of *ac
+	 *
+	 * @return AN, the number of called alleles; -1 if the record has no GT
+	 */
+	int vcf_count_alleles(const vcf_hdr_t *h, const vcf1_t *v, int32_t **ac, int *m_ac);
+
+	/**
+	 * Pack GT into 2-bit codes, four samples per byte with the first sample
+	 * in the lowest bits. The code is the number of non-reference alleles,
+	 * capped at 2, or 3 if any allele is missing. Padding bits are set to 3.
+	 *
+	 * @param dst  at least (n_sample+3)/4 bytes
+	 * @return 0 on success; -1 if the record has no GT or a ploidy above 8,
+	 *         in which case all samples are set to missing
+	 */
+	int vcf_pack_gt2(const vcf_hdr_t *h, const vcf1_t *v, uint8_t *dst);
+
+	/**
+	 * List the samples whose genotype is not homozygous reference.
+	 *
+	 * Diploid int8 GT is scanned 32 samples at a time with SSE2, so that
+	 * runs of 0/0 cost one comparison per block.
+	 *
+	 * @param c    (*c)[i] is sample<<2|code with the code of vcf_pack_gt2(),
+	 *             1, 2 or 3; reallocated if shorter than needed
+	 * @param m_c  capacity of *c
+	 *
+	 * @return number of carriers, in the order of samples; -1 if the record
+	 *         has no GT or a ploidy above 8
+	 */
+	int vcf_get_carriers(const vcf_hdr_t *h, const vcf1_t *v, uint32_t **c, int *m_c);
+
+	/**
+	 * Write the carriers of all records in BCF _fn_ to the sidecar
+	 * "fn.cix", which vcf_cix_open() uses as long as the key of _fn_ is
+	 * unchanged.
+	 *
+	 * @return 0 on success and -1 on failure
+	 */
+	int vcf_cix_build(const char *fn);
+
+	/**
+	 * Identify the contents of file _fn_ for sidecars: its size, mtime and
+	 * the CRC32 of its last 64KB. A sidecar whose recorded key differs is
+	 * stale.
+	 *
+	 * @return 0 on success and -1 if _fn_ cannot be read
+	 */
+	int vcf_file_key(const char *fn, uint64_t key[3]);
+
+	/**
+	 * Open sidecar "fn"+_ext_ of BCF _fn_. A sidecar starts with
+	 * VCF_SIDECAR_HDR raw bytes: _magic_, 4 reserved bytes and the key of
+	 * _fn_ when the sidecar was written.
+	 *
+	 * @param name  what the sidecar holds, for the warnings
+	 *
+	 * @return a descriptor positioned after the header; -1 if the sidecar is
+	 *         absent, corrupted or stale
+	 */
+	int vcf_sidecar_open(const char *fn, const char *ext, const char *magic, const char *name);
+
+	/**
+	 * Create "fn"+_ext_+".tmp" and write the header of a sidecar with an
+	 * empty key. The caller writes the rest, closes the descriptor and calls
+	 * vcf_sidecar_close_w().
+	 *
+	 * @return a descriptor positioned after the header; -1 on failure
+	 */
+	int vcf_sidecar_open_w(const char *fn, const char *ext, const char *magic);
+
+	/**
+	 * Finish a sidecar of vcf_sidecar_open_w(). If _ret_ is 0, the key of _fn_
+	 * is put into the header and the temporary file is renamed to "fn"+_ext_,
+	 * so that a sidecar in use, possibly mapped, is replaced atomically.
+	 * Otherwise the temporary file is removed.
+	 *
+	 * @return 0 on success and -1 on failure or if _ret_ is not 0
+	 */
+	int vcf_sidecar_close_w(const char *fn, const char *ext, int ret);
+
+	/**
+	 * Open the carrier index of BCF _fn_ with header _h_; 0 if absent,
+	 * corrupted, stale or for a different number of samples
+	 */
+	vcf_cix_t *vcf_cix_open(const char *fn, const vcf_hdr_t *h);
+
+	/**
+	 * Read the carriers of the next record, in the format of
+	 * vcf_get_carriers(), without touching the BCF. Contigs and samples
+	 * are checked against the header given to vcf_cix_open().
+	 *
+	 * @return number of carriers; -1 at the end of the file or on a
+	 *         malformed record, which is reported to stderr
+	 */
+	int vcf_cix_read1(vcf_cix_t *c, int *rid, int *pos, uint32_t **a, int *m_a);
+
+	void vcf_cix_close(vcf_cix_t *c);
+
+	/**
+	 * Get the typed value of INFO/_id_ in a record.
+	 *
+	 * On the first call for a record, the offsets of all INFO fields are
+	 * recorded in vcf1_t::aux; later calls are O(1). The table is reset by
+	 * vcf_read1() and vcf_parse1(); callers that modify vcf1_t::shared
+	 * otherwise must not rely on pointers obtained before.
+	 *
+	 * @return pointer to the size/type byte of the value; NULL if absent
+	 */
+	uint8_t *vcf_get_info_ptr(const vcf_hdr_t *h, vcf1_t *v, int id);
+
+	/**
+	 * Extract the values of an INFO field.
+	 *
+	 * @param type  VCF_HT_INT for int32_t (missing as INT32_MIN), VCF_HT_REAL
+	 *              for float, VCF_HT_STR for a NULL terminated string or
+	 *              VCF_HT_FLAG
+	 * @param dst   buffer, reallocated if shorter than needed
+	 * @param ndst  capacity of *dst in elements, updated on reallocation
+	 *
+	 * @return number of values; for VCF_HT_FLAG, 1 if set and 0 otherwise;
+	 *         -1 if absent; -2 if the field is of a different type
+	 */
+	int vcf_get_info_values(const vcf_hdr_t *h, vcf1_t *v, const char *key, void **dst, int *ndst, int type);
 
 #ifdef __cplusplus
 }
@@ -212,4 +510,13 @@ static inline int32_t vcf_dec_size(const uint8_t *p, uint8_t **q, int *type)
 	} else return vcf_dec_typed_int1(p + 1, q);
 }
 
+static inline uint8_t *vcf_skip_typed(const uint8_t *p)
+{
+	int32_t n;
+	int type;
+	uint8_t *q;
+	n = vcf_dec_size(p, &q, &type);
+	return q + (n << vcf_type_shift[type]);
+}
+
 #endif
@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "kstring.h"
+#include "vcfcol.h"
+
+#define COL_MAGIC   "COL\3"
+#define COL_CHUNK   0x10000
+#define COL_MAX_RAW 0x4000000 // also end a chunk when its columns hold more than 64MB
+
+enum { COL_CHROM, COL_POS, COL_RLEN, COL_QUAL, COL_ALLELE, COL_FILTER, COL_GT, COL_INFO, COL_FMT };
+#define COL_N_FIXED 7
+
+typedef struct {
+	int32_t kind, key; // key: the header ID of INFO/FMT columns
+} col_desc_t;
+
+typedef struct {
+	uint64_t off;
+	uint32_t l_comp, l_raw; // l_comp == 0 if the column has no data in the chunk
+} col_blk_t;
+
+struct vcf_col_writer_t {
+	FILE *fp;
+	char *fn_bcf;
+	int n_sample, gt_id, n_id, n_col, m_col, m_fmt;
+	int n_rec, n_chunk, m_chunk, last_pos, n_dict;
+	int64_t n_tot;
+	int *info_col, *fmt_col; // column of each header ID; -1 if none yet
+	col_desc_t *col;
+	int64_t *seen; // the last record with a value in each column
+	kstring_t *buf, dict, code; // raw data of each column in the current chunk; FILTER dictionary and codes
+	uint32_t *dict_off;
+	int32_t *chunk_n, *blk_n; // per chunk: records and columns at the time
+	col_blk_t **blk;
+	vcf_fmt_t *fmt;
+	uint8_t *gt;
+	size_t total;
+};
+
+static int col_add(vcf_col_writer_t *w, int kind, int key)
+{
+	int c = w->n_col;
+	if (w->n_col == w->m_col) {
+		w->m_col = w->m_col? w->m_col<<1 : 16;
+		w->col = (col_desc_t*)realloc(w->col, w->m_col * sizeof(col_desc_t));
+		w->buf = (kstring_t*)realloc(w->buf, w->m_col * sizeof(kstring_t));
+		w->seen = (int64_t*)realloc(w->seen, w->m_col * 8);
+	}
+	++w->n_col;
+	w->col[c].kind = kind, w->col[c].key = key;
+	memset(&w->buf[c], 0, sizeof(kstring_t));
+	w->seen[c] = -1;
+	if (kind >= COL_GT) { // earlier records in the chunk do not have the field
+		ks_resize(&w->buf[c], w->n_rec + 1);
+		memset(w->buf[c].s, 0, w->n_rec);
+		w->buf[c].l = w->n_rec;
+	}
+	return c;
+}
+
+static void col_put(vcf_col_writer_t *w, int c, const void *p, size_t l)
+{
+	kputsn((const char*)p, l, &w->buf[c]);
+	w->total += l;
+}
+
+vcf_col_writer_t *vcf_col_open_w(const char *fn, const vcf_hdr_t *h)
+{
+	vcf_col_writer_t *w;
+	FILE *fp;
+	int i, fd;
+	if ((fd = vcf_sidecar_open_w(fn, ".col", COL_MAGIC)) < 0) return 0;
+	if ((fp = fdopen(fd, "wb")) == 0) {
+		close(fd);
+		vcf_sidecar_close_w(fn, ".col", -1);
+		return 0;
+	}
+	w = (vcf_col_writer_t*)calloc(1, sizeof(vcf_col_writer_t));
+	w->fp = fp;
+	w->fn_bcf = strdup(fn);
+	w->n_sample = h->n[VCF_DT_SAMPLE];
+	w->gt_id = vcf_id2int(h, VCF_DT_ID, "GT");
+	w->n_id = h->n[VCF_DT_ID];
+	w->info_col = (int*)malloc((w->n_id + 1) * sizeof(int));
+	w->fmt_col = (int*)malloc((w->n_id + 1) * sizeof(int));
+	for (i = 0; i < w->n_id; ++i) w->info_col[i] = w->fmt_col[i] = -1;
+	for (i = 0; i < COL_N_FIXED; ++i) col_add(w, i, -1);
+	w->gt = (uint8_t*)malloc((w->n_sample + 3) / 4 + 1);
+	return w;
+}
+
+static void col_flush(vcf_col_writer_t *w)
+{
+	int c, i;
+	uint8_t *z = 0;
+	uLongf l_z;
+	col_blk_t *b;
+	kstring_t *f = &w->buf[COL_FILTER];
+	if (w->n_rec == 0) return;
+	kputsn((char*)&w->n_dict, 4, f); // FILTER: the dictionary, then the codes
+	for (i = 0; i < w->n_dict; ++i) {
+		uint32_t l = w->dict_off[i+1] - w->dict_off[i];
+		kputsn((char*)&l, 4, f);
+		kputsn(w->dict.s + w->dict_off[i], l, f);
+	}
+	kputsn(w->code.s, w->code.l, f);
+	if (w->n_chunk == w->m_chunk) {
+		w->m_chunk = w->m_chunk? w->m_chunk<<1 : 16;
+		w->chunk_n = (int32_t*)realloc(w->chunk_n, w->m_chunk * 4);
+		w->blk_n = (int32_t*)realloc(w->blk_n, w->m_chunk * 4);
+		w->blk = (col_blk_t**)realloc(w->blk, w->m_chunk * sizeof(col_blk_t*));
+	}
+	w->chunk_n[w->n_chunk] = w->n_rec, w->blk_n[w->n_chunk] = w->n_col;
+	b = w->blk[w->n_chunk++] = (col_blk_t*)calloc(w->n_col, sizeof(col_blk_t));
+	for (c = 0; c < w->n_col; ++c) {
+		kstring_t *s = &w->buf[c];
+		if (s->l == 0) continue;
+		l_z = compressBound(s->l);
+		z = (uint8_t*)realloc(z, l_z);
+		compress2(z, &l_z, (const Bytef*)s->s, s->l, Z_DEFAULT_COMPRESSION);
+		b[c].off = ftell(w->fp), b[c].l_comp = l_z, b[c].l_raw = s->l;
+		fwrite(z, 1, l_z, w->fp);
+		s->l = 0;
+	}
+	free(z);
+	w->n_rec = w->n_dict = 0, w->last_pos = 0;
+	w->dict.l = w->code.l = 0;
+	w->total = 0;
+}
+
+static int col_filter_code(vcf_col_writer_t *w, const uint8_t *p, uint32_t l) // the dictionary is small: FILTER combinations are few
+{
+	int i;
+	for (i = 0; i < w->n_dict; ++i)
+		if (w->dict_off[i+1] - w->dict_off[i] == l && memcmp(w->dict.s + w->dict_off[i], p, l) == 0) return i;
+	w->dict_off = (uint32_t*)realloc(w->dict_off, (w->n_dict + 2) * 4);
+	if (w->n_dict == 0) w->dict_off[0] = 0;
+	kputsn((const char*)p, l, &w->dict);
+	w->dict_off[++w->n_dict] = w->dict.l;
+	return i;
+}
+
+int vcf_col_write1(vcf_col_writer_t *w, const vcf_hdr_t *h, const vcf1_t *v)
+{
+	uint8_t *p, *q, one = 1;
+	int i, c;
+	uint16_t x16;
+	uint32_t x32;
+	if (v->n_sample != w->n_sample) return -1;
+	col_put(w, COL_CHROM, &v->rid, 4);
+	x32 = v->pos - w->last_pos, w->last_pos = v->pos;
+	col_put(w, COL_POS, &x32, 4);
+	col_put(w, COL_RLEN, &v->rlen, 4);
+	col_put(w, COL_QUAL, &v->qual, 4);
+	// ID, REF and ALT
+	p = q = (uint8_t*)v->shared.s;
+	for (i = 0; i < 1 + v->n_allele; ++i) q = vcf_skip_typed(q);
+	x16 = v->n_allele, x32 = q - p;
+	col_put(w, COL_ALLELE, &x16, 2);
+	col_put(w, COL_ALLELE, &x32, 4);
+	col_put(w, COL_ALLELE, p, x32);
+	// FILTER
+	p = vcf_skip_typed(q);
+	x16 = col_filter_code(w, q, p - q);
+	kputsn((char*)&x16, 2, &w->code);
+	// INFO
+	for (i = 0; i < v->n_info; ++i) {
+		int key = vcf_dec_typed_int1(p, &p);
+		q = vcf_skip_typed(p);
+		if (key < 0 || key >= w->n_id) { // not in the header; dropped
+			p = q;
+			continue;
+		}
+		if ((c = w->info_col[key]) < 0) c = w->info_col[key] = col_add(w, COL_INFO, key);
+		col_put(w, c, &one, 1);
+		col_put(w, c, p, q - p);
+		w->seen[c] = w->n_tot;
+		p = q;
+	}
+	// FORMAT
+	if (v->n_fmt > w->m_fmt) {
+		w->m_fmt = v->n_fmt;
+		w->fmt = (vcf_fmt_t*)realloc(w->fmt, w->m_fmt * sizeof(vcf_fmt_t));
+	}
+	vcf_unpack_fmt_core((uint8_t*)v->indiv.s, v->n_sample, v->n_fmt, w->fmt);
+	for (i = 0; i < v->n_fmt; ++i) {
+		vcf_fmt_t *f = &w->fmt[i];
+		if (f->id < 0 || f->id >= w->n_id) continue;
+		if (f->id == w->gt_id) {
+			if (vcf_pack_gt2(h, v, w->gt) < 0) continue;
+			col_put(w, COL_GT, &one, 1);
+			col_put(w, COL_GT, w->gt, (w->n_sample + 3) / 4);
+			w->seen[COL_GT] = w->n_tot;
+		} else {
+			if ((c = w->fmt_col[f->id]) < 0) c = w->fmt_col[f->id] = col_add(w, COL_FMT, f->id);
+			col_put(w, c, &one, 1);
+			vcf_enc_size(&w->buf[c], f->n, f->type);
+			col_put(w, c, f->p, (size_t)v->n_sample * f->size);
+			w->seen[c] = w->n_tot;
+		}
+	}
+	for (c = COL_GT; c < w->n_col; ++c) // mark absent fields
+		if (w->seen[c] != w->n_tot) kputc(0, &w->buf[c]);
+	++w->n_tot;
+	if (++w->n_rec == COL_CHUNK || w->total > COL_MAX_RAW) col_flush(w);
+	return 0;
+}
+
+int vcf_col_close_w(vcf_col_writer_t *w)
+{
+	int c, i, ret = 0;
+	uint64_t x64;
+	int32_t x[4];
+	static const col_blk_t zero = {0, 0, 0};
+	col_flush(w);
+	x64 = ftell(w->fp);
+	x[0] = w->n_sample, x[1] = w->n_col, x[2] = w->n_chunk;
+	fwrite(x, 4, 3, w->fp);
+	fwrite(w->col, sizeof(col_desc_t), w->n_col, w->fp);
+	for (i = 0; i < w->n_chunk; ++i) {
+		fwrite(&w->chunk_n[i], 4, 1, w->fp);
+		for (c = 0; c < w->n_col; ++c)
+			fwrite(c < w->blk_n[i]? &w->blk[i][c] : &zero, sizeof(col_blk_t), 1, w->fp);
+	}
+	fwrite(&x64, 8, 1, w->fp);
+	if (ferror(w->fp)) ret = -1;
+	if (fclose(w->fp) != 0) ret = -1;
+	ret = vcf_sidecar_close_w(w->fn_bcf, ".col", ret);
+	for (c = 0; c < w->n_col; ++c) free(w->buf[c].s);
+	for (i = 0; i < w->n_chunk; ++i) free(w->blk[i]);
+	free(w->buf); free(w->col); free(w->seen); free(w->info_col); free(w->fmt_col);
+	free(w->dict.s); free(w->code.s); free(w->dict_off);
+	free(w->chunk_n); free(w->blk_n); free(w->blk);
+	free(w->fmt); free(w->gt);
+	free(w->fn_bcf);
+	free(w);
+	return ret;
+}
+
+int vcf_col_build(const char *fn)
+{
+	vcfFile *in;
+	vcf_hdr_t *h;
+	vcf1_t *v;
+	vcf_col_writer_t *w;
+	int ret = 0;
+	if ((in = vcf_open(fn, "rb", 0)) == 0) return -1;
+	h = vcf_hdr_read(in);
+	if ((w = vcf_col_open_w(fn, h)) == 0) ret = -1;
+	else {
+		v = vcf_init1();
+		while (vcf_read1(in, h, v) >= 0)
+			if (vcf_col_write1(w, h, v) < 0) ret = -1;
+		vcf_destroy1(v);
+	}
+	vcf_hdr_destroy(h);
+	vcf_close(in);
+	if (w && vcf_col_close_w(w) < 0) ret = -1;
+	return ret;
+}
+
+/**********
+ * Reader *
+ **********/
+
+struct vcf_col_t {
+	FILE *fp;
+	int n_sample, n_col, n_chunk, gt_id;
+	int i_chunk, i_rec, n_rec, pos, n_dict;
+	col_desc_t *col;
+	int32_t *chunk_n;
+	col_blk_t *blk; // n_chunk * n_col
+	uint8_t *sel; // columns to read
+	kstring_t *raw; // decompressed columns of the current chunk
+	size_t *cur; // the next record in each column
+	uint8_t *z;
+	size_t m_z;
+	const uint8_t **dict;
+	uint32_t *dict_l;
+	const uint16_t *code;
+};
+
+static int col_load_chunk(vcf_col_t *c)
+{
+	int j;
+	for (j = 0; j < c->n_col; ++j) {
+		const col_blk_t *b = &c->blk[(size_t)c->i_chunk * c->n_col + j];
+		uLongf l;
+		c->raw[j].l = c->cur[j] = 0;
+		if (!c->sel[j] || b->l_comp == 0) continue;
+		if (b->l_comp > c->m_z) {
+			c->m_z = b->l_comp;
+			c->z = (uint8_t*)realloc(c->z, c->m_z);
+		}
+		ks_resize(&c->raw[j], b->l_raw + 1);
+		l = b->l_raw;
+		if (fseek(c->fp, b->off, SEEK_SET) < 0 || fread(c->z, 1, b->l_comp, c->fp) != b->l_comp) return -1;
+		if (uncompress((Bytef*)c->raw[j].s, &l, c->z, b->l_comp) != Z_OK || l != b->l_raw) return -1;
+		c->raw[j].l = l;
+	}
+	c->n_rec = c->chunk_n[c->i_chunk], c->i_rec = 0, c->pos = 0;
+	for (j = COL_CHROM; j <= COL_QUAL; ++j) // fixed-width columns must be complete
+		if (c->sel[j] && c->raw[j].l < (size_t)c->n_rec * 4) return -1;
+	if (c->sel[COL_FILTER]) { // FILTER dictionary
+		const uint8_t *p = (const uint8_t*)c->raw[COL_FILTER].s, *end = p + c->raw[COL_FILTER].l;
+		if (end - p < 4) return -1;
+		memcpy(&c->n_dict, p, 4), p += 4;
+		c->dict = (const uint8_t**)realloc(c->dict, (c->n_dict + 1) * sizeof(void*));
+		c->dict_l = (uint32_t*)realloc(c->dict_l, (c->n_dict + 1) * 4);
+		for (j = 0; j < c->n_dict; ++j) {
+			if (end - p < 4) return -1;
+			memcpy(&c->dict_l[j], p, 4), p += 4;
+			if ((uint32_t)(end - p) < c->dict_l[j]) return -1;
+			c->dict[j] = p, p += c->dict_l[j];
+		}
+		if ((size_t)(end - p) < (size_t)c->n_rec * 2) return -1;
+		c->code = (const uint16_t*)p;
+	}
+	return 0;
+}
+
+static int col_find(const vcf_col_t *c, int kind, int key)
+{
+	int j;
+	for (j = 0; j < c->n_col; ++j)
+		if (c->col[j].kind == kind && c->col[j].key == key) return j;
+	return -1;
+}
+
+vcf_col_t *vcf_col_open(const char *fn, const vcf_hdr_t *h, const char *fields)
+{
+	vcf_col_t *c;
+	FILE *fp;
+	char *str;
+	uint64_t off;
+	int32_t x[3];
+	int i, j, fd;
+	kstring_t s = {0,0,0};
+	if ((fd = vcf_sidecar_open(fn, ".col", COL_MAGIC, "columnar store")) < 0) return 0;
+	if ((fp = fdopen(fd, "rb")) == 0) {
+		close(fd);
+		return 0;
+	}
+	c = (vcf_col_t*)calloc(1, sizeof(vcf_col_t));
+	c->fp = fp;
+	if (fseek(fp, -8, SEEK_END) < 0 || fread(&off, 8, 1, fp) != 1 || off < VCF_SIDECAR_HDR
+		|| fseek(fp, off, SEEK_SET) < 0 || fread(x, 4, 3, fp) != 3 || x[1] < COL_N_FIXED || x[2] < 0)
+		goto bad;
+	c->n_sample = x[0], c->n_col = x[1], c->n_chunk = x[2];
+	c->col = (col_desc_t*)malloc(c->n_col * sizeof(col_desc_t));
+	c->chunk_n = (int32_t*)malloc((c->n_chunk + 1) * 4);
+	c->blk = (col_blk_t*)malloc(((size_t)c->n_chunk * c->n_col + 1) * sizeof(col_blk_t));
+	if (fread(c->col, sizeof(col_desc_t), c->n_col, fp) != (size_t)c->n_col) goto bad;
+	for (i = 0; i < c->n_chunk; ++i)
+		if (fread(&c->chunk_n[i], 4, 1, fp) != 1 || fread(c->blk + (size_t)i * c->n_col, sizeof(col_blk_t), c->n_col, fp) != (size_t)c->n_col)
+			goto bad;
+	c->sel = (uint8_t*)calloc(c->n_col, 1);
+	c->raw = (kstring_t*)calloc(c->n_col, sizeof(kstring_t));
+	c->cur = (size_t*)calloc(c->n_col, sizeof(size_t));
+	c->gt_id = vcf_id2int(h, VCF_DT_ID, "GT");
+	c->sel[COL_CHROM] = c->sel[COL_POS] = c->sel[COL_RLEN] = 1;
+	kputs(fields? fields : "", &s);
+	for (str = strtok(s.s, ","); str; str = strtok(0, ",")) {
+		const char *key = str;
+		int kind = COL_INFO, id;
+		if (strcmp(str, "CHROM") == 0 || strcmp(str, "POS") == 0) continue;
+		if (strcmp(str, "QUAL") == 0) c->sel[COL_QUAL] = 1;
+		else if (strcmp(str, "ID") == 0 || strcmp(str, "REF") == 0 || strcmp(str, "ALT") == 0) c->sel[COL_ALLELE] = 1;
+		else if (strcmp(str, "FILTER") == 0) c->sel[COL_FILTER] = 1;
+		else if (strcmp(str, "GT") == 0 || strcmp(str, "FMT/GT") == 0 || strcmp(str, "FORMAT/GT") == 0) c->sel[COL_GT] = 1;
+		else {
+			if (strncmp(str, "INFO/", 5) == 0) key = str + 5;
+			else if (strncmp(str, "FMT/", 4) == 0) key = str + 4, kind = COL_FMT;
+			else if (strncmp(str, "FORMAT/", 7) == 0) key = str + 7, kind = COL_FMT;
+			if ((id = vcf_id2int(h, VCF_DT_ID, key)) < 0) {
+				if (vcf_verbose >= 1)
+					fprintf(stderr, "[E::%s] field '%s' is not defined in the header\n", __func__, str);
+				free(s.s);
+				vcf_col_close(c);
+				return 0;
+			}
+			if ((j = col_find(c, kind, id)) >= 0) c->sel[j] = 1; // otherwise absent from all records
+		}
+	}
+	free(s.s);
+	c->i_chunk = -1;
+	return c;
+
+bad:
+	if (vcf_verbose >= 2)
+		fprintf(stderr, "[W::%s] the columnar store of '%s' is corrupted; ignored\n", __func__, fn);
+	vcf_col_close(c);
+	return 0;
+}
+
+int vcf_col_read1(vcf_col_t *c, vcf1_t *v)
+{
+	int i, j;
+	while (c->i_chunk < 0 || c->i_rec == c->n_rec) {
+		if (++c->i_chunk >= c->n_chunk) return -1;
+		if (col_load_chunk(c) < 0) {
+			if (vcf_verbose >= 1)
+				fprintf(stderr, "[E::%s] failed to read chunk %d of the columnar store\n", __func__, c->i_chunk);
+			c->i_chunk = c->n_chunk;
+			return -1;
+		}
+	}
+	i = c->i_rec++;
+	v->rid = ((int32_t*)c->raw[COL_CHROM].s)[i];
+	v->pos = c->pos += ((int32_t*)c->raw[COL_POS].s)[i];
+	v->rlen = ((int32_t*)c->raw[COL_RLEN].s)[i];
+	if (c->sel[COL_QUAL]) v->qual = ((float*)c->raw[COL_QUAL].s)[i];
+	else {
+		int32_t y = 0x7F800001;
+		memcpy(&v->qual, &y, 4);
+	}
+	v->shared.l = v->indiv.l = 0;
+	v->n_allele = 0, v->n_info = 0, v->n_fmt = 0, v->n_sample = c->n_sample;
+	if (c->sel[COL_ALLELE] && c->cur[COL_ALLELE] + 6 <= c->raw[COL_ALLELE].l) {
+		const uint8_t *p = (const uint8_t*)c->raw[COL_ALLELE].s + c->cur[COL_ALLELE];
+		uint16_t n;
+		uint32_t l;
+		memcpy(&n, p, 2), memcpy(&l, p + 2, 4);
+		if (c->cur[COL_ALLELE] + 6 + l > c->raw[COL_ALLELE].l) return -1;
+		kputsn((const char*)p + 6, l, &v->shared);
+		v->n_allele = n;
+		c->cur[COL_ALLELE] += 6 + l;
+	} else vcf_enc_size(&v->shared, 0, VCF_BT_CHAR); // empty ID
+	if (c->sel[COL_FILTER] && c->code[i] < c->n_dict) kputsn((const char*)c->dict[c->code[i]], c->dict_l[c->code[i]], &v->shared);
+	else vcf_enc_size(&v->shared, 0, VCF_BT_NULL);
+	for (j = COL_GT; j < c->n_col; ++j) {
+		uint8_t *p, *q, *end;
+		int n, type;
+		kstring_t *r = &c->raw[j];
+		if (!c->sel[j] || c->cur[j] >= r->l) continue;
+		p = (uint8_t*)r->s + c->cur[j]++, end = (uint8_t*)r->s + r->l;
+		if (*p++ == 0) continue;
+		if (c->col[j].kind == COL_INFO) q = vcf_skip_typed(p);
+		else if (c->col[j].kind == COL_FMT) {
+			n = vcf_dec_size(p, &q, &type);
+			q += (size_t)c->n_sample * (n << vcf_type_shift[type]);
+		} else q = p + (c->n_sample + 3) / 4;
+		if (q > end) return -1;
+		c->cur[j] = q - (uint8_t*)r->s;
+		if (c->col[j].kind == COL_INFO) {
+			vcf_enc_int1(&v->shared, c->col[j].key);
+			kputsn((char*)p, q - p, &v->shared);
+			++v->n_info;
+		} else if (c->col[j].kind == COL_FMT) {
+			vcf_enc_int1(&v->indiv, c->col[j].key);
+			kputsn((char*)p, q - p, &v->indiv);
+			++v->n_fmt;
+		} else { // GT, from 2-bit codes to unphased diploid genotypes
+			static const char gt[4][2] = {{2,2}, {2,4}, {4,4}, {0,0}};
+			int k;
+			vcf_enc_int1(&v->indiv, c->gt_id);
+			vcf_enc_size(&v->indiv, 2, VCF_BT_INT8);
+			for (k = 0; k < c->n_sample; ++k)
+				kputsn(gt[p[k>>2] >> (k&3)*2 & 3], 2, &v->indiv);
+			++v->n_fmt;
+		}
+	}
+	vcf_aux_reset(v);
+	return 0;
+}
+
+void vcf_col_close(vcf_col_t *c)
+{
+	int j;
+	if (c == 0) return;
+	if (c->raw)
+		for (j = 0; j < c->n_col; ++j) free(c->raw[j].s);
+	fclose(c->fp);
+	free(c->col); free(c->chunk_n); free(c->blk); free(c->sel); free(c->raw); free(c->cur);
+	free(c->z); free(c->dict); free(c->dict_l);
+	free(c);
+}
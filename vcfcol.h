@@ -0,0 +1,84 @@
+#ifndef VCFCOL_H
+#define VCFCOL_H
+
+#include <stdint.h>
+#include "vcf.h"
+
+/* === Columnar store ===
+
+   "in.bcf.col" keeps the fields of in.bcf column by column, so that a scan
+   touching a few fields only inflates those. Records are grouped into
+   chunks of up to 65536 records; within a chunk, each column is a separate
+   zlib block:
+
+     CHROM, RLEN  int32_t per record
+     POS          int32_t deltas from the previous record
+     QUAL         float
+     ALLELE       ID, REF and ALT: uint16_t n_allele, uint32_t length and
+                  the typed strings as in vcf1_t::shared
+     FILTER       a dictionary of the distinct typed FILTER vectors, then a
+                  uint16_t code per record
+     INFO/key     per record a presence byte and the typed value
+     FMT/key      per record a presence byte, the size/type and the values
+                  of all samples, as in vcf1_t::indiv
+     GT           per record a presence byte and vcf_pack_gt2() codes
+
+   The file starts with the header of vcf_sidecar_open() with "COL\3" and
+   ends with a directory: n_sample, the columns, and for each chunk the number of records
+   and the offset and the compressed and raw lengths of each column,
+   followed by the offset of the directory as uint64_t.
+
+   GT keeps dosages only: phase and the identity of ALT alleles are lost.
+*/
+
+typedef struct vcf_col_writer_t vcf_col_writer_t;
+typedef struct vcf_col_t vcf_col_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/** Start "fn.col" for the BCF _fn_ being written with header _h_ */
+	vcf_col_writer_t *vcf_col_open_w(const char *fn, const vcf_hdr_t *h);
+
+	int vcf_col_write1(vcf_col_writer_t *w, const vcf_hdr_t *h, const vcf1_t *v);
+
+	/**
+	 * Finish the store. Call after the BCF is closed; its key is recorded
+	 * to detect a stale store.
+	 *
+	 * @return 0 on success and -1 on I/O errors
+	 */
+	int vcf_col_close_w(vcf_col_writer_t *w);
+
+	/** Write "fn.col" for an existing BCF _fn_; 0 on success and -1 on failure */
+	int vcf_col_build(const char *fn);
+
+	/**
+	 * Open the store of BCF _fn_ for reading selected fields.
+	 *
+	 * @param fields  comma-separated list of QUAL, ID, REF, ALT, FILTER,
+	 *                INFO/key, FMT/key (or FORMAT/key) and GT; CHROM, POS
+	 *                and RLEN are always read
+	 * @return 0 if the store is absent, stale or lacks a field of the
+	 *         header, which is reported to stderr
+	 */
+	vcf_col_t *vcf_col_open(const char *fn, const vcf_hdr_t *h, const char *fields);
+
+	/**
+	 * Read the next record as a partial vcf1_t holding the selected fields
+	 * only, so that vcf_get_info_values(), vcf_get_format_int32() and the
+	 * like work on it. Without ID/REF/ALT, n_allele is 0; without QUAL, QUAL
+	 * is missing.
+	 *
+	 * @return 0 on success and -1 at the end of the store or on errors
+	 */
+	int vcf_col_read1(vcf_col_t *c, vcf1_t *v);
+
+	void vcf_col_close(vcf_col_t *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
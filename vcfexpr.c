@@ -0,0 +1,625 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include "vcfexpr.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum {
+	OP_NUM, OP_STR, OP_QUAL, OP_POS, OP_INFO, OP_FILTER, OP_FMT, // operands
+	OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE,
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_NEG, OP_NOT,
+	OP_AND, OP_OR, // jump to _id_ if the result is decided by the left operand
+	OP_AND_END, OP_OR_END // combine the two operands if no jump has been taken
+};
+
+typedef struct {
+	int op, id; // id: header ID for OP_INFO/OP_FILTER/OP_FMT; string index for OP_STR; jump target for OP_AND/OP_OR
+	double x;   // the number for OP_NUM; string length for OP_STR; 1 for Flag INFO; 1 for FILTER!=
+} expr_ins_t;
+
+typedef struct {
+	double x;
+	const char *s; // non-NULL for strings, which are not NULL terminated
+	int l;
+} expr_val_t;
+
+typedef struct { // a stack slot of the per-sample evaluator
+	int is_vec; // if true, the value is in v[]; otherwise in z
+	expr_val_t z;
+	float *v; // one value per sample; NaN for missing
+} expr_col_t;
+
+struct vcf_expr_t {
+	const vcf_hdr_t *h;
+	int n, m, n_str, is_smpl;
+	expr_ins_t *a;
+	char **str;
+	expr_val_t *stack;
+	// for the per-sample evaluator
+	int m_smpl, m_fmt;
+	expr_col_t *col;
+	vcf_fmt_t *fmt;
+};
+
+/************
+ * Compiler *
+ ************/
+
+typedef struct {
+	const vcf_hdr_t *h;
+	const char *str, *p; // the expression and the current position
+	vcf_expr_t *e;
+	int err, is_smpl;
+} expr_parser_t;
+
+static void ps_error(expr_parser_t *ps, const char *msg)
+{
+	if (ps->err) return; // only report the first error
+	ps->err = 1;
+	if (vcf_verbose >= 1)
+		fprintf(stderr, "[E::vcf_expr_compile] %s at position %d of '%s'\n", msg, (int)(ps->p - ps->str) + 1, ps->str);
+}
+
+static int emit(expr_parser_t *ps, int op, int id, double x)
+{
+	vcf_expr_t *e = ps->e;
+	if (e->n == e->m) {
+		e->m = e->m? e->m<<1 : 16;
+		e->a = (expr_ins_t*)realloc(e->a, e->m * sizeof(expr_ins_t));
+	}
+	e->a[e->n].op = op, e->a[e->n].id = id, e->a[e->n].x = x;
+	return e->n++;
+}
+
+static int accept(expr_parser_t *ps, const char *tok)
+{
+	int l = strlen(tok);
+	while (isspace(*ps->p)) ++ps->p;
+	if (strncmp(ps->p, tok, l) != 0) return 0;
+	ps->p += l;
+	return 1;
+}
+
+static int word_len(expr_parser_t *ps) // length of the identifier at the current position
+{
+	const char *q;
+	while (isspace(*ps->p)) ++ps->p;
+	if (!isalpha(*ps->p) && *ps->p != '_') return 0;
+	for (q = ps->p; isalnum(*q) || *q == '_' || *q == '.'; ++q);
+	if (*q == '/' && ((q - ps->p == 4 && strncmp(ps->p, "INFO", 4) == 0) || (q - ps->p == 6 && strncmp(ps->p, "FORMAT", 6) == 0) || (q - ps->p == 3 && strncmp(ps->p, "FMT", 3) == 0)))
+		for (++q; isalnum(*q) || *q == '_' || *q == '.'; ++q); // a prefixed key
+	return q - ps->p;
+}
+
+static int accept_word(expr_parser_t *ps, const char *w)
+{
+	int l = word_len(ps);
+	if (l != (int)strlen(w) || strncmp(ps->p, w, l) != 0) return 0;
+	ps->p += l;
+	return 1;
+}
+
+static int parse_cmpop(expr_parser_t *ps)
+{
+	if (accept(ps, "==")) return OP_EQ;
+	if (accept(ps, "!=")) return OP_NE;
+	if (accept(ps, "<=")) return OP_LE;
+	if (accept(ps, ">=")) return OP_GE;
+	if (accept(ps, "=")) return OP_EQ;
+	if (accept(ps, "<")) return OP_LT;
+	if (accept(ps, ">")) return OP_GT;
+	return -1;
+}
+
+static char *parse_string(expr_parser_t *ps) // a quoted string; the quote has been consumed
+{
+	char quote = ps->p[-1], *s;
+	const char *q;
+	for (q = ps->p; *q && *q != quote; ++q);
+	if (*q == 0) {
+		ps_error(ps, "unterminated string");
+		return 0;
+	}
+	s = (char*)calloc(q - ps->p + 1, 1);
+	strncpy(s, ps->p, q - ps->p);
+	ps->p = q + 1;
+	return s;
+}
+
+static int add_string(expr_parser_t *ps, char *s)
+{
+	vcf_expr_t *e = ps->e;
+	e->str = (char**)realloc(e->str, (e->n_str + 1) * sizeof(char*));
+	e->str[e->n_str] = s;
+	return e->n_str++;
+}
+
+static void parse_or(expr_parser_t *ps);
+
+static void parse_primary(expr_parser_t *ps)
+{
+	int l;
+	if (ps->err) return;
+	if (accept(ps, "(")) {
+		parse_or(ps);
+		if (!accept(ps, ")")) ps_error(ps, "missing ')'");
+	} else if (accept(ps, "\"") || accept(ps, "'")) {
+		char *s = parse_string(ps);
+		if (s) emit(ps, OP_STR, add_string(ps, s), strlen(s));
+	} else if (isdigit(*ps->p) || (*ps->p == '.' && isdigit(ps->p[1]))) {
+		char *q;
+		double x = strtod(ps->p, &q);
+		ps->p = q;
+		emit(ps, OP_NUM, 0, x);
+	} else if (accept_word(ps, "QUAL")) {
+		emit(ps, OP_QUAL, 0, 0);
+	} else if (accept_word(ps, "POS")) {
+		emit(ps, OP_POS, 0, 0);
+	} else if ((l = word_len(ps)) > 0) {
+		char *key;
+		int id;
+		if (strncmp(ps->p, "FILTER", 6) == 0 && l == 6) {
+			ps_error(ps, "FILTER can only be compared to a string");
+			return;
+		}
+		if ((l > 7 && strncmp(ps->p, "FORMAT/", 7) == 0) || (l > 4 && strncmp(ps->p, "FMT/", 4) == 0)) {
+			int type;
+			if (!ps->is_smpl) {
+				ps_error(ps, "FORMAT fields are only allowed in per-sample filters");
+				return;
+			}
+			l -= ps->p[1] == 'O'? 7 : 4, ps->p += ps->p[1] == 'O'? 7 : 4;
+			key = (char*)calloc(l + 1, 1);
+			strncpy(key, ps->p, l);
+			id = vcf_id2int(ps->h, VCF_DT_ID, key);
+			type = id >= 0? ps->h->id[VCF_DT_ID][id].val->info[VCF_HL_FMT]>>4&0xf : 15;
+			if (id < 0 || ps->h->id[VCF_DT_ID][id].val->info[VCF_HL_FMT] == 15) ps_error(ps, "undefined FORMAT field");
+			else if (type != VCF_HT_INT && type != VCF_HT_REAL) ps_error(ps, "only numeric FORMAT fields are supported");
+			free(key);
+			if (ps->err) return;
+			ps->p += l;
+			emit(ps, OP_FMT, id, 0);
+			return;
+		}
+		if (l > 5 && strncmp(ps->p, "INFO/", 5) == 0) ps->p += 5, l -= 5;
+		key = (char*)calloc(l + 1, 1);
+		strncpy(key, ps->p, l);
+		id = vcf_id2int(ps->h, VCF_DT_ID, key);
+		free(key);
+		if (id < 0 || ps->h->id[VCF_DT_ID][id].val->info[VCF_HL_INFO] == 15) {
+			ps_error(ps, "undefined INFO field");
+			return;
+		}
+		ps->p += l;
+		emit(ps, OP_INFO, id, (ps->h->id[VCF_DT_ID][id].val->info[VCF_HL_INFO]>>4&0xf) == VCF_HT_FLAG);
+	} else ps_error(ps, "syntax error");
+}
+
+static void parse_unary(expr_parser_t *ps)
+{
+	if (accept(ps, "!")) {
+		parse_unary(ps);
+		emit(ps, OP_NOT, 0, 0);
+	} else if (accept(ps, "-")) {
+		parse_unary(ps);
+		emit(ps, OP_NEG, 0, 0);
+	} else parse_primary(ps);
+}
+
+static void parse_prod(expr_parser_t *ps)
+{
+	parse_unary(ps);
+	while (!ps->err) {
+		if (accept(ps, "*")) parse_unary(ps), emit(ps, OP_MUL, 0, 0);
+		else if (accept(ps, "/")) parse_unary(ps), emit(ps, OP_DIV, 0, 0);
+		else break;
+	}
+}
+
+static void parse_sum(expr_parser_t *ps)
+{
+	parse_prod(ps);
+	while (!ps->err) {
+		if (accept(ps, "+")) parse_prod(ps), emit(ps, OP_ADD, 0, 0);
+		else if (accept(ps, "-")) parse_prod(ps), emit(ps, OP_SUB, 0, 0);
+		else break;
+	}
+}
+
+static void parse_cmp(expr_parser_t *ps)
+{
+	int op;
+	if (ps->err) return;
+	if (accept_word(ps, "FILTER")) { // FILTER is a set; only membership tests are allowed
+		char *s;
+		int id;
+		op = parse_cmpop(ps);
+		if ((op != OP_EQ && op != OP_NE) || !(accept(ps, "\"") || accept(ps, "'"))) {
+			ps_error(ps, "FILTER can only be compared to a string with = or !=");
+			return;
+		}
+		if ((s = parse_string(ps)) == 0) return;
+		if (strcmp(s, ".") == 0) id = -1;
+		else if ((id = vcf_id2int(ps->h, VCF_DT_ID, s)) < 0 || ps->h->id[VCF_DT_ID][id].val->info[VCF_HL_FLT] == 15) {
+			free(s);
+			ps_error(ps, "undefined FILTER");
+			return;
+		}
+		free(s);
+		emit(ps, OP_FILTER, id, op == OP_NE);
+		return;
+	}
+	parse_sum(ps);
+	if (!ps->err && (op = parse_cmpop(ps)) >= 0) {
+		parse_sum(ps);
+		emit(ps, op, 0, 0);
+	}
+}
+
+static void parse_and(expr_parser_t *ps)
+{
+	parse_cmp(ps);
+	while (!ps->err && (accept(ps, "&&") || accept(ps, "&"))) {
+		int j = emit(ps, OP_AND, 0, 0);
+		parse_cmp(ps);
+		emit(ps, OP_AND_END, 0, 0);
+		ps->e->a[j].id = ps->e->n;
+	}
+}
+
+static void parse_or(expr_parser_t *ps)
+{
+	parse_and(ps);
+	while (!ps->err && (accept(ps, "||") || accept(ps, "|"))) {
+		int j = emit(ps, OP_OR, 0, 0);
+		parse_and(ps);
+		emit(ps, OP_OR_END, 0, 0);
+		ps->e->a[j].id = ps->e->n;
+	}
+}
+
+static vcf_expr_t *expr_compile(const vcf_hdr_t *h, const char *str, int is_smpl)
+{
+	expr_parser_t ps;
+	ps.h = h, ps.str = ps.p = str, ps.err = 0, ps.is_smpl = is_smpl;
+	ps.e = (vcf_expr_t*)calloc(1, sizeof(vcf_expr_t));
+	ps.e->h = h, ps.e->is_smpl = is_smpl;
+	parse_or(&ps);
+	while (isspace(*ps.p)) ++ps.p;
+	if (!ps.err && *ps.p) ps_error(&ps, "unexpected characters");
+	if (ps.err) {
+		vcf_expr_destroy(ps.e);
+		return 0;
+	}
+	ps.e->stack = (expr_val_t*)malloc((ps.e->n + 1) * sizeof(expr_val_t));
+	if (is_smpl) ps.e->col = (expr_col_t*)calloc(ps.e->n + 1, sizeof(expr_col_t));
+	return ps.e;
+}
+
+vcf_expr_t *vcf_expr_compile(const vcf_hdr_t *h, const char *str)
+{
+	return expr_compile(h, str, 0);
+}
+
+vcf_expr_t *vcf_expr_compile_smpl(const vcf_hdr_t *h, const char *str)
+{
+	return expr_compile(h, str, 1);
+}
+
+void vcf_expr_destroy(vcf_expr_t *e)
+{
+	int i;
+	if (e == 0) return;
+	for (i = 0; i < e->n_str; ++i) free(e->str[i]);
+	if (e->col)
+		for (i = 0; i <= e->n; ++i) free(e->col[i].v);
+	free(e->str); free(e->a); free(e->stack); free(e->col); free(e->fmt);
+	free(e);
+}
+
+/*************
+ * Evaluator *
+ *************/
+
+static inline int truth(const expr_val_t *z)
+{
+	return z->s? z->l > 0 : z->x != 0. && !isnan(z->x);
+}
+
+static void info_value(const vcf_hdr_t *h, vcf1_t *v, const expr_ins_t *c, expr_val_t *z)
+{
+	uint8_t *p = vcf_get_info_ptr(h, v, c->id);
+	int n, type;
+	z->s = 0;
+	if (p == 0) {
+		z->x = c->x != 0.? 0. : NAN; // an absent Flag is false; other absent fields are missing
+		return;
+	}
+	n = vcf_dec_size(p, &p, &type);
+	if (n == 0 || type == VCF_BT_NULL) z->x = 1.;
+	else if (type == VCF_BT_CHAR) z->s = (char*)p, z->l = n;
+	else if (type == VCF_BT_FLOAT) {
+		float f;
+		memcpy(&f, p, 4);
+		z->x = f; // the missing value is a NaN
+	} else {
+		int32_t y = vcf_dec_int1(p, type, &p);
+		if ((type == VCF_BT_INT8 && y == INT8_MIN) || (type == VCF_BT_INT16 && y == INT16_MIN) || y == INT32_MIN) z->x = NAN;
+		else z->x = y;
+	}
+}
+
+static int has_filter(const vcf1_t *v, int id) // id < 0 tests for an empty FILTER
+{
+	uint8_t *p;
+	int i, n, type;
+	p = vcf_skip_typed((uint8_t*)v->shared.s); // ID
+	for (i = 0; i < v->n_allele; ++i) p = vcf_skip_typed(p);
+	n = vcf_dec_size(p, &p, &type);
+	if (id < 0) return n == 0;
+	for (i = 0; i < n; ++i)
+		if (vcf_dec_int1(p, type, &p) == id) return 1;
+	return 0;
+}
+
+static double compare(int op, const expr_val_t *a, const expr_val_t *b)
+{
+	int c;
+	if (a->s == 0 && b->s == 0) {
+		switch (op) {
+		case OP_EQ: return a->x == b->x;
+		case OP_NE: return a->x != b->x;
+		case OP_LT: return a->x <  b->x;
+		case OP_LE: return a->x <= b->x;
+		case OP_GT: return a->x >  b->x;
+		default:    return a->x >= b->x;
+		}
+	}
+	if (a->s == 0 || b->s == 0) return op == OP_NE; // a string never equals a number
+	c = memcmp(a->s, b->s, a->l < b->l? a->l : b->l);
+	if (c == 0) c = a->l - b->l;
+	switch (op) {
+	case OP_EQ: return c == 0;
+	case OP_NE: return c != 0;
+	case OP_LT: return c <  0;
+	case OP_LE: return c <= 0;
+	case OP_GT: return c >  0;
+	default:    return c >= 0;
+	}
+}
+
+static inline double num(const expr_val_t *z) { return z->s? NAN : z->x; }
+
+static void load_scalar(const vcf_expr_t *e, vcf1_t *v, const expr_ins_t *c, expr_val_t *z)
+{
+	z->s = 0;
+	switch (c->op) {
+	case OP_NUM: z->x = c->x; break;
+	case OP_STR: z->s = e->str[c->id], z->l = (int)c->x; break;
+	case OP_QUAL: z->x = v->qual; break; // the missing QUAL is a NaN
+	case OP_POS: z->x = v->pos + 1; break;
+	case OP_INFO: info_value(e->h, v, c, z); break;
+	case OP_FILTER: z->x = has_filter(v, c->id) ^ (int)c->x; break;
+	}
+}
+
+static void scalar_op(int op, expr_val_t *a, const expr_val_t *b) // a = a op b, or a = op a for unary operators
+{
+	switch (op) {
+	case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE: a->x = compare(op, a, b); break;
+	case OP_ADD: a->x = num(a) + num(b); break;
+	case OP_SUB: a->x = num(a) - num(b); break;
+	case OP_MUL: a->x = num(a) * num(b); break;
+	case OP_DIV: a->x = num(a) / num(b); break;
+	case OP_NEG: a->x = -num(a); break;
+	case OP_NOT: a->x = !truth(a); break;
+	case OP_AND_END: a->x = truth(b); break; // the left operand is true, or the jump would have been taken
+	case OP_OR_END:  a->x = truth(b); break;
+	}
+	a->s = 0;
+}
+
+int vcf_expr_has_key(const vcf_expr_t *e, int type, int id)
+{
+	int i, op = type == VCF_HL_FMT? OP_FMT : OP_INFO;
+	for (i = 0; i < e->n; ++i)
+		if (e->a[i].op == op && e->a[i].id == id) return 1;
+	return 0;
+}
+
+int vcf_expr_eval(vcf_expr_t *e, vcf1_t *v)
+{
+	expr_val_t *s = e->stack;
+	int i, k = -1;
+	for (i = 0; i < e->n; ++i) {
+		const expr_ins_t *c = &e->a[i];
+		if (c->op <= OP_FILTER) load_scalar(e, v, c, &s[++k]);
+		else if (c->op == OP_NEG || c->op == OP_NOT) scalar_op(c->op, &s[k], 0);
+		else if (c->op == OP_AND) { // short-circuit: skip the right operand if the left is false
+			if (!truth(&s[k])) s[k].x = 0., s[k].s = 0, i = c->id - 1;
+		} else if (c->op == OP_OR) {
+			if (truth(&s[k])) s[k].x = 1., s[k].s = 0, i = c->id - 1;
+		} else --k, scalar_op(c->op, &s[k], &s[k+1]);
+	}
+	return truth(&s[0]);
+}
+
+/************************
+ * Per-sample evaluator *
+ ************************/
+
+// load the first value of each sample as float; missing values become NaN
+static void fmt_load(const vcf_fmt_t *f, int n, float *dst)
+{
+	int i = 0;
+	float nan = NAN;
+	if (f->n == 0) {
+		for (i = 0; i < n; ++i) dst[i] = nan;
+		return;
+	}
+	if (f->type == VCF_BT_FLOAT) {
+		for (i = 0; i < n; ++i) memcpy(&dst[i], f->p + (size_t)i * f->size, 4);
+		return;
+	}
+#ifdef __SSE2__
+	if (f->n == 1 && f->type == VCF_BT_INT8) {
+		__m128i m8 = _mm_set1_epi8(INT8_MIN);
+		__m128 vnan = _mm_set1_ps(nan);
+		for (; i + 16 <= n; i += 16) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(f->p + i)), m = _mm_cmpeq_epi8(x, m8), y, my, z, mz;
+			int j;
+			for (j = 0; j < 4; ++j) { // sign-extend bytes 4j..4j+3 to int32
+				y  = j < 2? _mm_unpacklo_epi8(x, x) : _mm_unpackhi_epi8(x, x);
+				my = j < 2? _mm_unpacklo_epi8(m, m) : _mm_unpackhi_epi8(m, m);
+				z  = _mm_srai_epi32(j&1? _mm_unpackhi_epi16(y, y) : _mm_unpacklo_epi16(y, y), 24);
+				mz = j&1? _mm_unpackhi_epi16(my, my) : _mm_unpacklo_epi16(my, my);
+				_mm_storeu_ps(dst + i + j * 4, _mm_or_ps(_mm_andnot_ps(_mm_castsi128_ps(mz), _mm_cvtepi32_ps(z)), _mm_and_ps(_mm_castsi128_ps(mz), vnan)));
+			}
+		}
+	} else if (f->n == 1 && f->type == VCF_BT_INT32) {
+		__m128i m32 = _mm_set1_epi32(INT32_MIN);
+		__m128 vnan = _mm_set1_ps(nan);
+		for (; i + 4 <= n; i += 4) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(f->p + i * 4));
+			__m128 m = _mm_castsi128_ps(_mm_cmpeq_epi32(x, m32));
+			_mm_storeu_ps(dst + i, _mm_or_ps(_mm_andnot_ps(m, _mm_cvtepi32_ps(x)), _mm_and_ps(m, vnan)));
+		}
+	}
+#endif
+	for (; i < n; ++i) {
+		const uint8_t *p = f->p + (size_t)i * f->size;
+		int32_t y;
+		if (f->type == VCF_BT_INT8) y = *(int8_t*)p == INT8_MIN? INT32_MIN : *(int8_t*)p;
+		else if (f->type == VCF_BT_INT16) {
+			int16_t z;
+			memcpy(&z, p, 2);
+			y = z == INT16_MIN? INT32_MIN : z;
+		} else memcpy(&y, p, 4);
+		dst[i] = y == INT32_MIN? nan : y;
+	}
+}
+
+static void vec_op(int op, int n, float *a, const float *b) // a[i] = a[i] op b[i]; NaN compares false except for !=
+{
+	int i = 0;
+#ifdef __SSE2__
+	__m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 x = _mm_loadu_ps(a + i), y = b? _mm_loadu_ps(b + i) : zero, z;
+		switch (op) {
+		case OP_EQ: z = _mm_and_ps(_mm_cmpeq_ps(x, y), one); break;
+		case OP_NE: z = _mm_and_ps(_mm_cmpneq_ps(x, y), one); break;
+		case OP_LT: z = _mm_and_ps(_mm_cmplt_ps(x, y), one); break;
+		case OP_LE: z = _mm_and_ps(_mm_cmple_ps(x, y), one); break;
+		case OP_GT: z = _mm_and_ps(_mm_cmpgt_ps(x, y), one); break;
+		case OP_GE: z = _mm_and_ps(_mm_cmpge_ps(x, y), one); break;
+		case OP_ADD: z = _mm_add_ps(x, y); break;
+		case OP_SUB: z = _mm_sub_ps(x, y); break;
+		case OP_MUL: z = _mm_mul_ps(x, y); break;
+		case OP_DIV: z = _mm_div_ps(x, y); break;
+		case OP_NEG: z = _mm_sub_ps(zero, x); break;
+		case OP_NOT: z = _mm_andnot_ps(_mm_and_ps(_mm_cmpneq_ps(x, zero), _mm_cmpord_ps(x, x)), one); break;
+		case OP_AND_END: z = _mm_and_ps(x, _mm_and_ps(_mm_and_ps(_mm_cmpneq_ps(y, zero), _mm_cmpord_ps(y, y)), one)); break;
+		default: /* OP_OR_END */ z = _mm_or_ps(x, _mm_and_ps(_mm_and_ps(_mm_cmpneq_ps(y, zero), _mm_cmpord_ps(y, y)), one)); break;
+		}
+		_mm_storeu_ps(a + i, z);
+	}
+#endif
+	for (; i < n; ++i) {
+		float x = a[i], y = b? b[i] : 0.0f;
+		switch (op) {
+		case OP_EQ: a[i] = x == y; break;
+		case OP_NE: a[i] = x != y; break;
+		case OP_LT: a[i] = x <  y; break;
+		case OP_LE: a[i] = x <= y; break;
+		case OP_GT: a[i] = x >  y; break;
+		case OP_GE: a[i] = x >= y; break;
+		case OP_ADD: a[i] = x + y; break;
+		case OP_SUB: a[i] = x - y; break;
+		case OP_MUL: a[i] = x * y; break;
+		case OP_DIV: a[i] = x / y; break;
+		case OP_NEG: a[i] = -x; break;
+		case OP_NOT: a[i] = !(x != 0.0f && !isnan(x)); break;
+		case OP_AND_END: a[i] = x != 0.0f && y != 0.0f && !isnan(y); break;
+		default: a[i] = x != 0.0f || (y != 0.0f && !isnan(y)); break;
+		}
+	}
+}
+
+static void col_expand(expr_col_t *c, int n) // broadcast a scalar to all samples
+{
+	int i;
+	float x;
+	if (c->is_vec) return;
+	x = num(&c->z);
+	for (i = 0; i < n; ++i) c->v[i] = x;
+	c->is_vec = 1;
+}
+
+static int col_bool(expr_col_t *c, int n, float x) // convert to 0/1; return true if all values equal _x_
+{
+	int i, all = 1;
+	for (i = 0; i < n; ++i) {
+		c->v[i] = c->v[i] != 0.0f && !isnan(c->v[i]);
+		if (c->v[i] != x) all = 0;
+	}
+	return all;
+}
+
+int vcf_expr_eval_smpl(vcf_expr_t *e, vcf1_t *v, uint8_t *pass)
+{
+	expr_col_t *s = e->col;
+	int i, k = -1, n = v->n_sample, n_pass;
+	if (n > e->m_smpl) {
+		e->m_smpl = n;
+		kroundup32(e->m_smpl);
+		for (i = 0; i <= e->n; ++i) s[i].v = (float*)realloc(s[i].v, e->m_smpl * sizeof(float));
+	}
+	if ((int)v->n_fmt > e->m_fmt) {
+		e->m_fmt = v->n_fmt;
+		e->fmt = (vcf_fmt_t*)realloc(e->fmt, e->m_fmt * sizeof(vcf_fmt_t));
+	}
+	vcf_unpack_fmt_core((uint8_t*)v->indiv.s, n, v->n_fmt, e->fmt);
+	for (i = 0; i < e->n; ++i) {
+		const expr_ins_t *c = &e->a[i];
+		if (c->op == OP_FMT) {
+			int j;
+			expr_col_t *z = &s[++k];
+			for (j = 0; j < (int)v->n_fmt; ++j)
+				if (e->fmt[j].id == c->id) break;
+			if (j < (int)v->n_fmt) fmt_load(&e->fmt[j], n, z->v), z->is_vec = 1;
+			else z->is_vec = 0, z->z.s = 0, z->z.x = NAN;
+		} else if (c->op <= OP_FILTER) {
+			s[++k].is_vec = 0;
+			load_scalar(e, v, c, &s[k].z);
+		} else if (c->op == OP_NEG || c->op == OP_NOT) {
+			if (s[k].is_vec) vec_op(c->op, n, s[k].v, 0);
+			else scalar_op(c->op, &s[k].z, 0);
+		} else if (c->op == OP_AND || c->op == OP_OR) { // jump if the left operand decides all samples
+			float x = c->op == OP_AND? 0.0f : 1.0f;
+			if (!s[k].is_vec) {
+				if (truth(&s[k].z) == (c->op == OP_OR)) s[k].z.x = x, s[k].z.s = 0, i = c->id - 1;
+				else s[k].z.x = truth(&s[k].z), s[k].z.s = 0; // 0/1, as vec_op() expects after broadcasting
+			} else if (col_bool(&s[k], n, x)) i = c->id - 1;
+		} else { // binary operators
+			--k;
+			if (!s[k].is_vec && !s[k+1].is_vec) scalar_op(c->op, &s[k].z, &s[k+1].z);
+			else {
+				col_expand(&s[k], n), col_expand(&s[k+1], n);
+				vec_op(c->op, n, s[k].v, s[k+1].v);
+			}
+		}
+	}
+	if (!s[0].is_vec) {
+		memset(pass, truth(&s[0].z), n);
+		return truth(&s[0].z)? n : 0;
+	}
+	for (i = n_pass = 0; i < n; ++i)
+		n_pass += (pass[i] = (s[0].v[i] != 0.0f && !isnan(s[0].v[i])));
+	return n_pass;
+}
@@ -0,0 +1,72 @@
+#ifndef VCFEXPR_H
+#define VCFEXPR_H
+
+#include "vcf.h"
+
+/* === Filter expressions ===
+
+   An expression such as 'QUAL>30 && INFO/DP>10 && FILTER="PASS"' is
+   compiled once against the header dictionary into a small stack bytecode
+   and evaluated on the typed values in vcf1_t::shared. Operators, from low
+   to high precedence:
+
+     || |    && &    == = != < <= > >=    + -    * /    ! - (unary)
+
+   Operands are numbers, quoted strings, QUAL, POS, INFO/key (or just key)
+   and FILTER, which may only be compared to a string with =, == or !=;
+   'FILTER="."' tests for an empty filter list. Only the first value of an
+   INFO array is used. A Flag is 1 if set and 0 otherwise; a missing value is
+   NaN, for which all comparisons but != are false. && and || short-circuit.
+
+   Per-sample expressions, compiled with vcf_expr_compile_smpl(), are
+   evaluated column-wise over all samples; see vcf_expr_eval_smpl().
+*/
+
+typedef struct vcf_expr_t vcf_expr_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * Compile an expression.
+	 *
+	 * @return the compiled expression; 0 on syntax errors or undefined keys,
+	 *         which are reported to stderr
+	 */
+	vcf_expr_t *vcf_expr_compile(const vcf_hdr_t *h, const char *str);
+
+	void vcf_expr_destroy(vcf_expr_t *e);
+
+	/**
+	 * Test if the expression reads field _id_ of _type_, VCF_HL_INFO or
+	 * VCF_HL_FMT.
+	 */
+	int vcf_expr_has_key(const vcf_expr_t *e, int type, int id);
+
+	/** @return 1 if _v_ passes the expression and 0 otherwise */
+	int vcf_expr_eval(vcf_expr_t *e, vcf1_t *v);
+
+	/**
+	 * Compile a per-sample expression, which may also refer to numeric
+	 * FORMAT fields as FORMAT/key or FMT/key. The first value of each sample
+	 * is used.
+	 */
+	vcf_expr_t *vcf_expr_compile_smpl(const vcf_hdr_t *h, const char *str);
+
+	/**
+	 * Evaluate a per-sample expression on all samples at once.
+	 *
+	 * Site-level operands are evaluated once; FORMAT values are loaded into
+	 * float columns and combined with SIMD comparisons.
+	 *
+	 * @param pass  pass[i] is set to 1 if sample i passes and 0 otherwise
+	 * @return number of passing samples
+	 */
+	int vcf_expr_eval_smpl(vcf_expr_t *e, vcf1_t *v, uint8_t *pass);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
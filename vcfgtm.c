@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vcfgtm.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define GTM_MAGIC "GTM\1"
+
+typedef struct {
+	char magic[4];
+	uint32_t layout, n_sample, n_ctg;
+	uint64_t n_site, l_row, off_geno, off_site, off_name, dummy;
+} gtm_hdr_t; // 64 bytes
+
+struct vcf_gtm_writer_t {
+	FILE *fp;
+	char *fn, *fn_tmp;
+	int layout;
+	gtm_hdr_t hdr;
+	int64_t m_site;
+	int32_t *site;
+	uint8_t *row;
+};
+
+static inline size_t gtm_align(size_t l) { return (l + 7) & ~(size_t)7; }
+
+static void gtm_pad(FILE *fp)
+{
+	static const char zero[8] = {0,0,0,0,0,0,0,0};
+	long l = ftell(fp);
+	fwrite(zero, 1, gtm_align(l) - l, fp);
+}
+
+/**********
+ * Writer *
+ **********/
+
+vcf_gtm_writer_t *vcf_gtm_open(const char *fn, const vcf_hdr_t *h, int layout)
+{
+	vcf_gtm_writer_t *w;
+	FILE *fp;
+	char *fn_tmp = 0;
+	int i;
+	if (layout == VCF_GTM_SAMPLE) { // variant-major rows go to a temporary file first
+		fn_tmp = (char*)malloc(strlen(fn) + 5);
+		strcat(strcpy(fn_tmp, fn), ".tmp");
+	}
+	if ((fp = fopen(fn_tmp? fn_tmp : fn, "wb")) == 0) {
+		free(fn_tmp);
+		return 0;
+	}
+	w = (vcf_gtm_writer_t*)calloc(1, sizeof(vcf_gtm_writer_t));
+	w->fp = fp, w->layout = layout, w->fn_tmp = fn_tmp;
+	w->fn = strdup(fn);
+	memcpy(w->hdr.magic, GTM_MAGIC, 4);
+	w->hdr.layout = VCF_GTM_SITE;
+	w->hdr.n_sample = h->n[VCF_DT_SAMPLE];
+	w->hdr.n_ctg = h->n[VCF_DT_CTG];
+	w->hdr.l_row = gtm_align((w->hdr.n_sample + 3) >> 2);
+	w->hdr.off_name = sizeof(gtm_hdr_t);
+	w->row = (uint8_t*)malloc(w->hdr.l_row);
+	memset(w->row, 0xff, w->hdr.l_row);
+	fwrite(&w->hdr, sizeof(gtm_hdr_t), 1, fp); // a placeholder; rewritten by vcf_gtm_close()
+	for (i = 0; i < h->n[VCF_DT_SAMPLE]; ++i)
+		fwrite(h->id[VCF_DT_SAMPLE][i].key, 1, strlen(h->id[VCF_DT_SAMPLE][i].key) + 1, fp);
+	for (i = 0; i < h->n[VCF_DT_CTG]; ++i)
+		fwrite(h->id[VCF_DT_CTG][i].key, 1, strlen(h->id[VCF_DT_CTG][i].key) + 1, fp);
+	gtm_pad(fp);
+	w->hdr.off_geno = ftell(fp);
+	return w;
+}
+
+int vcf_gtm_write1(vcf_gtm_writer_t *w, const vcf_hdr_t *h, const vcf1_t *v)
+{
+	if (v->n_sample != (int)w->hdr.n_sample) return -1;
+	vcf_pack_gt2(h, v, w->row); // all missing on failure
+	if ((int64_t)w->hdr.n_site == w->m_site) {
+		w->m_site = w->m_site? w->m_site<<1 : 1024;
+		w->site = (int32_t*)realloc(w->site, w->m_site * 8);
+	}
+	w->site[w->hdr.n_site*2] = v->rid;
+	w->site[w->hdr.n_site*2+1] = v->pos;
+	++w->hdr.n_site;
+	return fwrite(w->row, 1, w->hdr.l_row, w->fp) == w->hdr.l_row? 0 : -1;
+}
+
+#ifdef __SSE2__
+static inline __m128i mm_transpose4x4x2(__m128i x) // in each 32-bit lane, transpose the 4x4 matrix of 2-bit codes with rows in bytes
+{
+	__m128i t;
+	t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi32(x, 6)), _mm_set1_epi32(0x00cc00cc));
+	x = _mm_xor_si128(x, _mm_xor_si128(t, _mm_slli_epi32(t, 6)));
+	t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi32(x, 12)), _mm_set1_epi32(0x0000f0f0));
+	return _mm_xor_si128(x, _mm_xor_si128(t, _mm_slli_epi32(t, 12)));
+}
+#endif
+
+static inline uint32_t transpose4x4x2(uint32_t x)
+{
+	uint32_t t;
+	t = (x ^ x >> 6) & 0x00cc00cc, x ^= t ^ t << 6;
+	t = (x ^ x >> 12) & 0x0000f0f0, x ^= t ^ t << 12;
+	return x;
+}
+
+#define GTM_TILE_ROWS  256 // sites
+#define GTM_TILE_BYTES 64  // 256 samples
+
+/* Transpose the variant-major matrix _src_ into sample-major _dst_. The
+   matrix is processed in tiles of 256 sites by 256 samples, so that the
+   rows of both sides touched by a tile stay in the cache. Within a tile,
+   four sites at a time are interleaved into 32-bit words, each holding a
+   4x4 block of codes, which is transposed with two rounds of masked
+   swaps. */
+static void gtm_transpose(const uint8_t *src, int64_t n_site, size_t l_src, int n_sample, uint8_t *dst, size_t l_dst)
+{
+	int64_t r0, r, n_row = (int64_t)l_dst * 4; // sites beyond n_site are read as missing
+	size_t c0, c, c1, l_smpl = (n_sample + 3) >> 2;
+	uint8_t *ones;
+	ones = (uint8_t*)malloc(l_src);
+	memset(ones, 0xff, l_src);
+	for (r0 = 0; r0 < n_row; r0 += GTM_TILE_ROWS) {
+		for (c0 = 0; c0 < l_smpl; c0 += GTM_TILE_BYTES) {
+			c1 = c0 + GTM_TILE_BYTES < l_smpl? c0 + GTM_TILE_BYTES : l_smpl;
+			for (r = r0; r < r0 + GTM_TILE_ROWS && r < n_row; r += 4) {
+				const uint8_t *q[4];
+				uint8_t *d = dst + (r >> 2);
+				int k, j;
+				for (k = 0; k < 4; ++k)
+					q[k] = r + k < n_site? src + (r + k) * l_src : ones;
+				c = c0;
+#ifdef __SSE2__
+				for (; c + 16 <= c1; c += 16) {
+					__m128i x0 = _mm_loadu_si128((const __m128i*)(q[0] + c)), x1 = _mm_loadu_si128((const __m128i*)(q[1] + c));
+					__m128i x2 = _mm_loadu_si128((const __m128i*)(q[2] + c)), x3 = _mm_loadu_si128((const __m128i*)(q[3] + c));
+					__m128i y01, y23;
+					uint8_t b[64];
+					y01 = _mm_unpacklo_epi8(x0, x1), y23 = _mm_unpacklo_epi8(x2, x3);
+					_mm_storeu_si128((__m128i*)b,      mm_transpose4x4x2(_mm_unpacklo_epi16(y01, y23)));
+					_mm_storeu_si128((__m128i*)(b+16), mm_transpose4x4x2(_mm_unpackhi_epi16(y01, y23)));
+					y01 = _mm_unpackhi_epi8(x0, x1), y23 = _mm_unpackhi_epi8(x2, x3);
+					_mm_storeu_si128((__m128i*)(b+32), mm_transpose4x4x2(_mm_unpacklo_epi16(y01, y23)));
+					_mm_storeu_si128((__m128i*)(b+48), mm_transpose4x4x2(_mm_unpackhi_epi16(y01, y23)));
+					for (j = 0; j < 64 && (int)(c * 4) + j < n_sample; ++j)
+						d[(c * 4 + j) * l_dst] = b[j];
+				}
+#endif
+				for (; c < c1; ++c) {
+					uint32_t x = transpose4x4x2(q[0][c] | q[1][c] << 8 | q[2][c] << 16 | (uint32_t)q[3][c] << 24);
+					for (j = 0; j < 4 && (int)(c * 4) + j < n_sample; ++j)
+						d[(c * 4 + j) * l_dst] = x >> j * 8;
+				}
+			}
+		}
+	}
+	free(ones);
+}
+
+static int gtm_write_transposed(const char *fn, const vcf_gtm_t *g, const gtm_hdr_t *h0)
+{
+	gtm_hdr_t h = *h0;
+	size_t size;
+	uint8_t *map;
+	int fd, ret;
+	h.layout = VCF_GTM_SAMPLE;
+	h.l_row = gtm_align((g->n_site + 3) >> 2);
+	h.off_site = h.off_geno + h.l_row * h.n_sample;
+	size = h.off_site + h.n_site * 8;
+	if ((fd = open(fn, O_RDWR|O_CREAT|O_TRUNC, 0644)) < 0) return -1;
+	if (ftruncate(fd, size) < 0 || (map = (uint8_t*)mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	memcpy(map, &h, sizeof(gtm_hdr_t));
+	memcpy(map + h.off_name, (const uint8_t*)g->map + h.off_name, h.off_geno - h.off_name);
+	memcpy(map + h.off_site, g->site, h.n_site * 8);
+	gtm_transpose(g->geno, g->n_site, g->l_row, g->n_sample, map + h.off_geno, h.l_row);
+	ret = munmap(map, size);
+	return close(fd) == 0 && ret == 0? 0 : -1;
+}
+
+int vcf_gtm_close(vcf_gtm_writer_t *w)
+{
+	int ret = 0;
+	if (w == 0) return 0;
+	gtm_pad(w->fp);
+	w->hdr.off_site = ftell(w->fp);
+	fwrite(w->site, 8, w->hdr.n_site, w->fp);
+	fseek(w->fp, 0, SEEK_SET);
+	fwrite(&w->hdr, sizeof(gtm_hdr_t), 1, w->fp);
+	if (ferror(w->fp)) ret = -1;
+	if (fclose(w->fp) != 0) ret = -1;
+	if (ret == 0 && w->layout == VCF_GTM_SAMPLE) {
+		vcf_gtm_t *g;
+		if ((g = vcf_gtm_load(w->fn_tmp)) == 0 || gtm_write_transposed(w->fn, g, &w->hdr) < 0) ret = -1;
+		vcf_gtm_destroy(g);
+	}
+	if (w->fn_tmp) unlink(w->fn_tmp);
+	free(w->fn); free(w->fn_tmp); free(w->site); free(w->row);
+	free(w);
+	return ret;
+}
+
+/**********
+ * Reader *
+ **********/
+
+vcf_gtm_t *vcf_gtm_load(const char *fn)
+{
+	int fd, i;
+	struct stat st;
+	const gtm_hdr_t *h;
+	const char *p, *end;
+	uint64_t n_row, l_min;
+	vcf_gtm_t *g;
+	void *map;
+
+	if ((fd = open(fn, O_RDONLY)) < 0) return 0;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(gtm_hdr_t)) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+	h = (const gtm_hdr_t*)map;
+	n_row = h->layout == VCF_GTM_SITE? h->n_site : h->n_sample;
+	l_min = h->layout == VCF_GTM_SITE? (h->n_sample + 3) >> 2 : (h->n_site + 3) >> 2;
+	if (memcmp(h->magic, GTM_MAGIC, 4) != 0 || h->layout > VCF_GTM_SAMPLE || h->l_row < l_min || (h->l_row & 7)
+		|| h->off_name < sizeof(gtm_hdr_t) || h->off_geno < h->off_name || (h->off_geno & 7) || (h->off_site & 7)
+		|| h->off_site < h->off_geno + n_row * h->l_row || h->off_site + h->n_site * 8 > (uint64_t)st.st_size)
+	{
+		if (vcf_verbose >= 1)
+			fprintf(stderr, "[E::%s] '%s' is not a valid genotype matrix\n", __func__, fn);
+		munmap(map, st.st_size);
+		return 0;
+	}
+	g = (vcf_gtm_t*)calloc(1, sizeof(vcf_gtm_t));
+	g->map = map, g->l_map = st.st_size;
+	g->layout = h->layout, g->n_sample = h->n_sample, g->n_ctg = h->n_ctg, g->n_site = h->n_site;
+	g->l_row = h->l_row;
+	g->geno = (const uint8_t*)map + h->off_geno;
+	g->site = (const int32_t*)((const uint8_t*)map + h->off_site);
+	g->smpl = (const char**)malloc((g->n_sample + g->n_ctg + 1) * sizeof(char*));
+	g->ctg = g->smpl + g->n_sample;
+	p = (const char*)map + h->off_name, end = (const char*)map + h->off_geno;
+	for (i = 0; i < g->n_sample + g->n_ctg; ++i) {
+		const char *q;
+		if ((q = (const char*)memchr(p, 0, end - p)) == 0) break;
+		g->smpl[i] = p, p = q + 1;
+	}
+	if (i < g->n_sample + g->n_ctg) {
+		if (vcf_verbose >= 1)
+			fprintf(stderr, "[E::%s] truncated names in '%s'\n", __func__, fn);
+		vcf_gtm_destroy(g);
+		return 0;
+	}
+	return g;
+}
+
+void vcf_gtm_destroy(vcf_gtm_t *g)
+{
+	if (g == 0) return;
+	munmap(g->map, g->l_map);
+	free(g->smpl);
+	free(g);
+}
@@ -0,0 +1,75 @@
+#ifndef VCFGTM_H
+#define VCFGTM_H
+
+#include <stdint.h>
+#include "vcf.h"
+
+/* === Packed genotype matrix ===
+
+   A .gtm file holds GT as 2-bit dosage codes (see vcf_pack_gt2()) in an
+   uncompressed file that can be mmapped and indexed directly:
+
+     header    64 bytes: "GTM\1", layout, n_sample, n_ctg, n_site, l_row,
+               off_geno, off_site and off_name
+     names     n_sample sample names followed by n_ctg contig names, each
+               NULL terminated
+     geno      the matrix at off_geno, one row per site (variant-major,
+               VCF_GTM_SITE) or per sample (sample-major, VCF_GTM_SAMPLE);
+               rows are l_row bytes, a multiple of 8; padding codes are 3
+     site      n_site pairs of int32_t: contig index and 0-based position
+
+   Sections start at 8-byte boundaries. Integers are in the host byte order.
+*/
+
+#define VCF_GTM_SITE   0
+#define VCF_GTM_SAMPLE 1
+
+typedef struct {
+	int layout, n_sample, n_ctg;
+	int64_t n_site;
+	size_t l_row;
+	const uint8_t *geno; // row i starts at geno + i * l_row
+	const int32_t *site; // contig and position of site i at site[i*2] and site[i*2+1]
+	const char **smpl, **ctg;
+	void *map;
+	size_t l_map;
+} vcf_gtm_t;
+
+typedef struct vcf_gtm_writer_t vcf_gtm_writer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * Create a .gtm file with the samples and contigs in _h_.
+	 *
+	 * Rows are written variant-major as records are added. For
+	 * VCF_GTM_SAMPLE, they go to "fn.tmp", which is transposed into _fn_ by
+	 * vcf_gtm_close().
+	 */
+	vcf_gtm_writer_t *vcf_gtm_open(const char *fn, const vcf_hdr_t *h, int layout);
+
+	/** Append one site; a record without GT is written as all missing */
+	int vcf_gtm_write1(vcf_gtm_writer_t *w, const vcf_hdr_t *h, const vcf1_t *v);
+
+	/** @return 0 on success and -1 on I/O errors */
+	int vcf_gtm_close(vcf_gtm_writer_t *w);
+
+	/** mmap a .gtm file; 0 if the file cannot be read or is malformed */
+	vcf_gtm_t *vcf_gtm_load(const char *fn);
+
+	void vcf_gtm_destroy(vcf_gtm_t *g);
+
+	/** @return the code of sample _j_ at site _i_ */
+	static inline int vcf_gtm_get(const vcf_gtm_t *g, int64_t i, int j)
+	{
+		if (g->layout == VCF_GTM_SITE) return g->geno[i * g->l_row + (j>>2)] >> (j&3)*2 & 3;
+		return g->geno[j * g->l_row + (i>>2)] >> (i&3)*2 & 3;
+	}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
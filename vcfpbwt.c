@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "bgzf.h"
+#include "kstring.h"
+#include "vcfpbwt.h"
+
+#define PBWT_MAGIC "PBW\3"
+
+struct vcf_pbwt_t {
+	BGZF *fp;
+	int n_hap, m_buf;
+	uint8_t *buf;
+};
+
+void vcf_pbwt_alleles(const vcf_hdr_t *h, const vcf1_t *v, uint8_t *y, int32_t **gt, int *m_gt)
+{
+	int i, j, n, w;
+	memset(y, 0, v->n_sample * 2);
+	if ((n = vcf_get_format_int32(h, v, "GT", gt, m_gt)) <= 0) return;
+	w = n / v->n_sample;
+	for (i = 0; i < v->n_sample; ++i)
+		for (j = 0; j < 2 && j < w; ++j) {
+			int32_t x = (*gt)[i * w + j];
+			y[i<<1|j] = x != INT32_MIN && x>>1 > 1;
+		}
+}
+
+static void pbwt_rle(int n, const uint8_t *col, kstring_t *s)
+{
+	int i, l;
+	s->l = 0;
+	if (n == 0) return;
+	kputc(col[0], s);
+	for (i = 1, l = 1; i <= n; ++i) {
+		if (i < n && col[i] == col[i-1]) {
+			++l;
+			continue;
+		}
+		for (; l >= 0x80; l >>= 7) kputc((l & 0x7f) | 0x80, s);
+		kputc(l, s);
+		l = 1;
+	}
+}
+
+static int pbwt_unrle(int n, const uint8_t *p, const uint8_t *end, uint8_t *col)
+{
+	int c, i = 0;
+	if (p == end) return n == 0? 0 : -1;
+	c = *p++ & 1;
+	while (p < end) {
+		uint32_t l = 0;
+		int sh = 0;
+		do {
+			if (p == end || sh > 28) return -1;
+			l |= (uint32_t)(*p & 0x7f) << sh, sh += 7;
+		} while (*p++ & 0x80);
+		if (l > (uint32_t)(n - i)) return -1;
+		memset(col + i, c, l);
+		i += l, c ^= 1;
+	}
+	return i == n? 0 : -1;
+}
+
+/*********
+ * Build *
+ *********/
+
+int vcf_pbwt_build(const char *fn)
+{
+	vcfFile *in = 0;
+	vcf_hdr_t *h;
+	vcf1_t *v;
+	BGZF *out;
+	int32_t *a, *b, *gt = 0, x[3];
+	uint8_t *y, *col;
+	int i, fd, n_hap, m_gt = 0, ret = 0;
+	kstring_t s = {0,0,0};
+	if ((fd = vcf_sidecar_open_w(fn, ".pbwt", PBWT_MAGIC)) < 0) return -1;
+	out = bgzf_dopen(fd, "w");
+	if (out == 0 || (in = vcf_open(fn, "rb", 0)) == 0) {
+		if (out) bgzf_close(out);
+		else close(fd);
+		return vcf_sidecar_close_w(fn, ".pbwt", -1);
+	}
+	h = vcf_hdr_read(in);
+	v = vcf_init1();
+	n_hap = h->n[VCF_DT_SAMPLE] * 2;
+	a = (int32_t*)malloc((n_hap + 1) * 4);
+	b = (int32_t*)malloc((n_hap + 1) * 4);
+	y = (uint8_t*)malloc(n_hap + 1);
+	col = (uint8_t*)malloc(n_hap + 1);
+	for (i = 0; i < n_hap; ++i) a[i] = i;
+	bgzf_write(out, &n_hap, 4);
+	while (vcf_read1(in, h, v) >= 0) {
+		int u, w;
+		vcf_pbwt_alleles(h, v, y, &gt, &m_gt);
+		for (i = 0; i < n_hap; ++i) col[i] = y[a[i]];
+		pbwt_rle(n_hap, col, &s);
+		x[0] = v->rid, x[1] = v->pos, x[2] = s.l;
+		bgzf_write(out, x, 12);
+		bgzf_write(out, s.s, s.l);
+		for (i = u = w = 0; i < n_hap; ++i) // stable partition by the allele
+			if (col[i]) b[w++] = a[i];
+			else a[u++] = a[i];
+		memcpy(a + u, b, w * 4);
+	}
+	if (bgzf_close(out) != 0) ret = -1;
+	vcf_destroy1(v);
+	vcf_hdr_destroy(h);
+	vcf_close(in);
+	free(a); free(b); free(y); free(col); free(gt); free(s.s);
+	return vcf_sidecar_close_w(fn, ".pbwt", ret);
+}
+
+/**********
+ * Reader *
+ **********/
+
+vcf_pbwt_t *vcf_pbwt_open(const char *fn)
+{
+	vcf_pbwt_t *p;
+	BGZF *fp;
+	int fd;
+	if ((fd = vcf_sidecar_open(fn, ".pbwt", PBWT_MAGIC, "PBWT")) < 0) return 0;
+	if ((fp = bgzf_dopen(fd, "r")) == 0) {
+		close(fd);
+		return 0;
+	}
+	p = (vcf_pbwt_t*)calloc(1, sizeof(vcf_pbwt_t));
+	p->fp = fp;
+	if (bgzf_read(fp, &p->n_hap, 4) != 4 || p->n_hap < 0) {
+		if (vcf_verbose >= 2)
+			fprintf(stderr, "[W::%s] the PBWT of '%s' is corrupted; ignored\n", __func__, fn);
+		vcf_pbwt_close(p);
+		return 0;
+	}
+	return p;
+}
+
+int vcf_pbwt_n_hap(const vcf_pbwt_t *p) { return p->n_hap; }
+
+int vcf_pbwt_read1(vcf_pbwt_t *p, int *rid, int *pos, uint8_t *col)
+{
+	int32_t x[3];
+	if (bgzf_read(p->fp, x, 12) != 12 || x[2] < 0) return -1;
+	if (x[2] > p->m_buf) {
+		p->m_buf = x[2];
+		kroundup32(p->m_buf);
+		p->buf = (uint8_t*)realloc(p->buf, p->m_buf);
+	}
+	if (bgzf_read(p->fp, p->buf, x[2]) != x[2]) return -1;
+	if (pbwt_unrle(p->n_hap, p->buf, p->buf + x[2], col) < 0) return -1;
+	*rid = x[0], *pos = x[1];
+	return 0;
+}
+
+void vcf_pbwt_close(vcf_pbwt_t *p)
+{
+	if (p == 0) return;
+	bgzf_close(p->fp);
+	free(p->buf);
+	free(p);
+}
+
+/************
+ * Matching *
+ ************/
+
+typedef struct {
+	int n_hap, n_row, k, rid, m_pos, min_len, n_b;
+	int32_t *a, *d, *a1, *d1, *pos, *b;
+	uint8_t *y;
+	vcf_pbwt_match_f report;
+	void *rdata;
+} pbwt_state_t;
+
+#define pbwt_cand(s, r) ((s)->n_row == (s)->n_hap || (s)->a[r] < (s)->n_hap) // a possible partner: panel rows with queries
+
+/* Report the set-maximal matches ending right before site s->k (Durbin's
+   algorithm 4, generalized to skip query rows). Row i has its longest
+   match starting at e, the smaller divergence to its nearest partners
+   above and below. All partners within divergence e form a block around i;
+   if any has the same allele as i at site k, the match extends and is not
+   maximal. With y == 0, at the end of a contig, nothing extends. */
+static void pbwt_report(pbwt_state_t *s, const uint8_t *y)
+{
+	int i, m, n, k = s->k;
+	const int32_t *a = s->a, *d = s->d;
+	for (i = 0; i < s->n_row; ++i) {
+		int du = k + 1, dd = k + 1, e, cur, ext = 0;
+		if (s->n_row > s->n_hap && a[i] < s->n_hap) continue; // with queries, only report for them
+		for (m = i - 1, cur = d[i]; m >= 0 && !pbwt_cand(s, m); cur = cur > d[m]? cur : d[m], --m);
+		if (m >= 0) du = cur;
+		for (n = i + 1, cur = n < s->n_row? d[n] : 0; n < s->n_row && !pbwt_cand(s, n); ) {
+			if (++n < s->n_row && d[n] > cur) cur = d[n];
+		}
+		if (n < s->n_row) dd = cur;
+		e = du < dd? du : dd;
+		if (e >= k || k - e < s->min_len) continue;
+		s->n_b = 0;
+		if (du == e) {
+			for (m = i - 1, cur = d[i]; m >= 0 && cur <= e; cur = cur > d[m]? cur : d[m], --m) {
+				if (!pbwt_cand(s, m)) continue;
+				if (y && y[m] == y[i]) {
+					ext = 1;
+					break;
+				}
+				s->b[s->n_b++] = a[m];
+			}
+		}
+		if (dd == e && !ext) {
+			for (n = i + 1, cur = d[n]; n < s->n_row && cur <= e; ) {
+				if (pbwt_cand(s, n)) {
+					if (y && y[n] == y[i]) {
+						ext = 1;
+						break;
+					}
+					s->b[s->n_b++] = a[n];
+				}
+				if (++n < s->n_row && d[n] > cur) cur = d[n];
+			}
+		}
+		if (ext) continue;
+		for (m = 0; m < s->n_b; ++m)
+			s->report(s->rdata, a[i], s->b[m], s->rid, s->pos[e], s->pos[k-1], k - e);
+	}
+}
+
+static void pbwt_update(pbwt_state_t *s, const uint8_t *y) // Durbin's algorithm 2 on prefix and divergence arrays
+{
+	int i, u, w, p, q;
+	p = q = s->k + 1;
+	for (i = u = w = 0; i < s->n_row; ++i) {
+		if (s->d[i] > p) p = s->d[i];
+		if (s->d[i] > q) q = s->d[i];
+		if (y[i] == 0) s->a[u] = s->a[i], s->d[u++] = p, p = 0;
+		else s->a1[w] = s->a[i], s->d1[w++] = q, q = 0;
+	}
+	memcpy(s->a + u, s->a1, w * 4);
+	memcpy(s->d + u, s->d1, w * 4);
+}
+
+int64_t vcf_pbwt_match(vcf_pbwt_t *p, int n_query, vcf_pbwt_query_f get_query, void *qdata, int min_len, vcf_pbwt_match_f report, void *rdata)
+{
+	pbwt_state_t s;
+	uint8_t *col, *z;
+	int i, j, rid, pos;
+	int64_t n_site = 0;
+	memset(&s, 0, sizeof(pbwt_state_t));
+	s.n_hap = p->n_hap, s.n_row = p->n_hap + n_query;
+	s.min_len = min_len > 1? min_len : 1;
+	s.report = report, s.rdata = rdata, s.rid = -1;
+	s.a = (int32_t*)malloc((s.n_row + 1) * 4);
+	s.d = (int32_t*)calloc(s.n_row + 1, 4);
+	s.a1 = (int32_t*)malloc((s.n_row + 1) * 4);
+	s.d1 = (int32_t*)malloc((s.n_row + 1) * 4);
+	s.b = (int32_t*)malloc((s.n_row + 1) * 4);
+	s.y = (uint8_t*)malloc(s.n_row + 1);
+	col = (uint8_t*)malloc(s.n_hap + 1);
+	z = (uint8_t*)calloc(n_query + 1, 1);
+	for (i = 0; i < s.n_row; ++i) s.a[i] = i;
+	while (vcf_pbwt_read1(p, &rid, &pos, col) == 0) {
+		if (rid != s.rid) { // matches do not span contigs
+			if (s.k > 0) pbwt_report(&s, 0);
+			memset(s.d, 0, s.n_row * 4);
+			s.k = 0, s.rid = rid;
+		}
+		if (s.k == s.m_pos) {
+			s.m_pos = s.m_pos? s.m_pos<<1 : 1024;
+			s.pos = (int32_t*)realloc(s.pos, s.m_pos * 4);
+		}
+		s.pos[s.k] = pos;
+		if (n_query) get_query(qdata, rid, pos, z);
+		for (i = j = 0; i < s.n_row; ++i) // the panel rows keep the order of the stored column
+			s.y[i] = s.a[i] < s.n_hap? col[j++] : z[s.a[i] - s.n_hap];
+		if (s.k > 0) pbwt_report(&s, s.y);
+		pbwt_update(&s, s.y);
+		++s.k, ++n_site;
+	}
+	if (s.k > 0) pbwt_report(&s, 0);
+	free(s.a); free(s.d); free(s.a1); free(s.d1); free(s.b); free(s.y); free(s.pos);
+	free(col); free(z);
+	return n_site;
+}
@@ -0,0 +1,90 @@
+#ifndef VCFPBWT_H
+#define VCFPBWT_H
+
+#include <stdint.h>
+#include "vcf.h"
+
+/* === Positional Burrows-Wheeler transform ===
+
+   The haplotypes of a phased BCF, two per sample, are sorted at each site
+   by their reversed prefixes (Durbin 2014). The sorted columns are run-
+   length encoded in the sidecar "in.bcf.pbwt", so that matching can replay
+   the transform without decoding any genotypes. An allele is 1 if it is
+   not REF and 0 for REF or missing; the phase bit of GT is ignored, so
+   unphased genotypes are taken in the order written.
+
+   After the header of vcf_sidecar_open() with "PBW\3", the sidecar is a
+   BGZF stream: the number of haplotypes as int32, then per site rid,
+   pos, the length of the column and the column: the first allele
+   followed by the run lengths as 7-bit varints.
+*/
+
+typedef struct vcf_pbwt_t vcf_pbwt_t;
+
+/**
+ * Called for each set-maximal match.
+ *
+ * @param i, j      haplotypes; panel haplotypes are 2*sample+k and query
+ *                  haplotype q is n_hap+q
+ * @param beg, end  0-based positions of the first and the last site
+ * @param len       number of sites in the match
+ */
+typedef void (*vcf_pbwt_match_f)(void *data, int i, int j, int rid, int beg, int end, int len);
+
+/**
+ * Fill z[0..n_query) with the query alleles at a panel site; called once
+ * per site in order. The function should set unknown alleles to 0.
+ */
+typedef void (*vcf_pbwt_query_f)(void *data, int rid, int pos, uint8_t *z);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * Set y[2*i+k] to the k-th allele of sample i as 0 or 1. The second
+	 * allele of a haploid call and all alleles of a record without GT are 0.
+	 *
+	 * @param gt, m_gt  buffer for vcf_get_format_int32()
+	 */
+	void vcf_pbwt_alleles(const vcf_hdr_t *h, const vcf1_t *v, uint8_t *y, int32_t **gt, int *m_gt);
+
+	/** Write "fn.pbwt" for BCF _fn_; 0 on success and -1 on failure */
+	int vcf_pbwt_build(const char *fn);
+
+	/** Open the PBWT of BCF _fn_; 0 if absent, corrupted or stale */
+	vcf_pbwt_t *vcf_pbwt_open(const char *fn);
+
+	int vcf_pbwt_n_hap(const vcf_pbwt_t *p);
+
+	/**
+	 * Read the next site.
+	 *
+	 * @param col  n_hap alleles in the order of the haplotypes sorted at
+	 *             this site
+	 * @return 0 on success and -1 at the end of the file or on errors
+	 */
+	int vcf_pbwt_read1(vcf_pbwt_t *p, int *rid, int *pos, uint8_t *col);
+
+	void vcf_pbwt_close(vcf_pbwt_t *p);
+
+	/**
+	 * Report set-maximal matches of at least _min_len_ sites, within each
+	 * contig.
+	 *
+	 * With n_query == 0, all pairs of panel haplotypes are considered, and
+	 * a match is reported for each of its haplotypes for which it is set-
+	 * maximal. Otherwise only matches between a query and the panel are
+	 * reported. Queries are inserted into the transform as extra
+	 * haplotypes, so the cost is one pass over the sidecar in O(n_hap +
+	 * n_query) per site, whatever the number of queries.
+	 *
+	 * @return number of sites read
+	 */
+	int64_t vcf_pbwt_match(vcf_pbwt_t *p, int n_query, vcf_pbwt_query_f get_query, void *qdata, int min_len, vcf_pbwt_match_f report, void *rdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kstring.h"
+#include "vcfsti.h"
+
+#define STI_MAGIC "STI\3"
+
+typedef struct {
+	uint32_t n_sample, dummy;
+	uint64_t n_site, l_heap;
+} sti_hdr_t; // 24 bytes after the sidecar header
+
+struct vcf_sti_writer_t {
+	FILE *fp;
+	char *fn_bcf;
+	int n_sample;
+	int64_t n_site;
+	kstring_t heap; // written after the sites by vcf_sti_close_w()
+};
+
+vcf_sti_writer_t *vcf_sti_open_w(const char *fn, const vcf_hdr_t *h)
+{
+	vcf_sti_writer_t *w;
+	sti_hdr_t hdr;
+	FILE *fp;
+	int fd;
+	if ((fd = vcf_sidecar_open_w(fn, ".sti", STI_MAGIC)) < 0) return 0;
+	if ((fp = fdopen(fd, "wb")) == 0) {
+		close(fd);
+		vcf_sidecar_close_w(fn, ".sti", -1);
+		return 0;
+	}
+	w = (vcf_sti_writer_t*)calloc(1, sizeof(vcf_sti_writer_t));
+	w->fp = fp;
+	w->fn_bcf = strdup(fn);
+	w->n_sample = h->n[VCF_DT_SAMPLE];
+	memset(&hdr, 0, sizeof(sti_hdr_t));
+	fwrite(&hdr, sizeof(sti_hdr_t), 1, fp); // a placeholder until the counts are known
+	return w;
+}
+
+int vcf_sti_write1(vcf_sti_writer_t *w, const vcf1_t *v, int64_t voff)
+{
+	vcf_site_t s;
+	uint8_t *p;
+	int i;
+	p = (uint8_t*)v->shared.s;
+	for (i = 0; i < 2 + v->n_allele; ++i) p = vcf_skip_typed(p); // ID, alleles and FILTER
+	s.voff = voff, s.off = w->heap.l;
+	s.rid = v->rid, s.pos = v->pos, s.rlen = v->rlen, s.qual = v->qual;
+	s.n_allele = v->n_allele, s.l_shared = p - (uint8_t*)v->shared.s;
+	kputsn(v->shared.s, s.l_shared, &w->heap);
+	++w->n_site;
+	return fwrite(&s, sizeof(vcf_site_t), 1, w->fp) == 1? 0 : -1;
+}
+
+int vcf_sti_close_w(vcf_sti_writer_t *w)
+{
+	int ret = 0;
+	sti_hdr_t hdr;
+	memset(&hdr, 0, sizeof(sti_hdr_t));
+	hdr.n_sample = w->n_sample, hdr.n_site = w->n_site, hdr.l_heap = w->heap.l;
+	fwrite(w->heap.s, 1, w->heap.l, w->fp);
+	if (fseek(w->fp, VCF_SIDECAR_HDR, SEEK_SET) < 0) ret = -1;
+	fwrite(&hdr, sizeof(sti_hdr_t), 1, w->fp);
+	if (ferror(w->fp)) ret = -1;
+	if (fclose(w->fp) != 0) ret = -1;
+	ret = vcf_sidecar_close_w(w->fn_bcf, ".sti", ret);
+	free(w->heap.s); free(w->fn_bcf);
+	free(w);
+	return ret;
+}
+
+int vcf_sti_build(const char *fn)
+{
+	vcfFile *in;
+	vcf_hdr_t *h;
+	vcf1_t *v;
+	vcf_sti_writer_t *w;
+	int64_t voff;
+	int ret = 0;
+	if ((in = vcf_open(fn, "rb", 0)) == 0) return -1;
+	h = vcf_hdr_read(in);
+	if ((w = vcf_sti_open_w(fn, h)) == 0) ret = -1;
+	else {
+		v = vcf_init1();
+		for (;;) {
+			voff = vcf_tell(in);
+			if (vcf_read1(in, h, v) < 0) break;
+			if (vcf_sti_write1(w, v, voff) < 0) ret = -1;
+		}
+		vcf_destroy1(v);
+	}
+	vcf_hdr_destroy(h);
+	vcf_close(in);
+	if (w && vcf_sti_close_w(w) < 0) ret = -1;
+	return ret;
+}
+
+vcf_sti_t *vcf_sti_load(const char *fn)
+{
+	int fd;
+	struct stat st;
+	const sti_hdr_t *h;
+	vcf_sti_t *s;
+	void *map = MAP_FAILED;
+	const size_t l_hdr = VCF_SIDECAR_HDR + sizeof(sti_hdr_t);
+	if ((fd = vcf_sidecar_open(fn, ".sti", STI_MAGIC, "sites table")) < 0) return 0;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)l_hdr)
+		map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	h = map == MAP_FAILED? 0 : (const sti_hdr_t*)((const uint8_t*)map + VCF_SIDECAR_HDR);
+	if (h == 0 || h->n_site > (uint64_t)st.st_size / sizeof(vcf_site_t)
+		|| l_hdr + h->n_site * sizeof(vcf_site_t) + h->l_heap != (uint64_t)st.st_size)
+	{
+		if (vcf_verbose >= 2)
+			fprintf(stderr, "[W::%s] the sites table of '%s' is corrupted; ignored\n", __func__, fn);
+		if (h) munmap(map, st.st_size);
+		return 0;
+	}
+	s = (vcf_sti_t*)calloc(1, sizeof(vcf_sti_t));
+	s->map = map, s->l_map = st.st_size;
+	s->n_sample = h->n_sample, s->n_site = h->n_site, s->l_heap = h->l_heap;
+	s->a = (const vcf_site_t*)((const uint8_t*)map + l_hdr);
+	s->heap = (const uint8_t*)(s->a + s->n_site);
+	return s;
+}
+
+void vcf_sti_destroy(vcf_sti_t *s)
+{
+	if (s == 0) return;
+	munmap(s->map, s->l_map);
+	free(s);
+}
+
+int vcf_sti_get(const vcf_sti_t *s, int64_t i, vcf1_t *v)
+{
+	const vcf_site_t *p = &s->a[i];
+	if (p->off > s->l_heap || p->l_shared > s->l_heap - p->off) return -1;
+	v->rid = p->rid, v->pos = p->pos, v->rlen = p->rlen, v->qual = p->qual;
+	v->n_allele = p->n_allele, v->n_info = v->n_fmt = 0, v->n_sample = 0;
+	v->shared.l = v->indiv.l = 0;
+	kputsn((const char*)s->heap + p->off, p->l_shared, &v->shared);
+	vcf_aux_reset(v);
+	return 0;
+}
+
+/************
+ * ID index *
+ ************/
+
+#define IDS_MAGIC "IDS\3"
+
+typedef struct {
+	uint32_t bits, dummy;
+	uint64_t n;
+} ids_hdr_t; // 16 bytes after the sidecar header
+
+struct vcf_ids_writer_t {
+	char *fn_bcf;
+	int64_t n, m;
+	vcf_ids_entry_t *a;
+	kstring_t str;
+};
+
+static inline uint64_t ids_hash(const char *s, int l) // FNV-1a, then the finalizer of MurmurHash3
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int i;
+	for (i = 0; i < l; ++i) h = (h ^ (uint8_t)s[i]) * 0x100000001b3ULL;
+	h ^= h >> 33, h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33, h *= 0xc4ceb9fe1a85ec53ULL;
+	return h ^ h >> 33;
+}
+
+static int ids_cmp(const void *a, const void *b)
+{
+	const vcf_ids_entry_t *x = (const vcf_ids_entry_t*)a, *y = (const vcf_ids_entry_t*)b;
+	if (x->fp != y->fp) return x->fp < y->fp? -1 : 1;
+	return (x->voff > y->voff) - (x->voff < y->voff);
+}
+
+vcf_ids_writer_t *vcf_ids_open_w(const char *fn)
+{
+	vcf_ids_writer_t *w;
+	w = (vcf_ids_writer_t*)calloc(1, sizeof(vcf_ids_writer_t));
+	w->fn_bcf = strdup(fn);
+	return w;
+}
+
+int vcf_ids_write1(vcf_ids_writer_t *w, const vcf1_t *v, int64_t voff)
+{
+	char *p, *q;
+	w->str.l = 0;
+	vcf_fmt_sized_array(&w->str, (uint8_t*)v->shared.s);
+	kputc(';', &w->str);
+	for (p = q = w->str.s; q < w->str.s + w->str.l; ++q) {
+		if (*q != ';') continue;
+		if (q > p && !(q - p == 1 && *p == '.')) {
+			if (w->n == w->m) {
+				w->m = w->m? w->m<<1 : 1024;
+				w->a = (vcf_ids_entry_t*)realloc(w->a, w->m * sizeof(vcf_ids_entry_t));
+			}
+			w->a[w->n].fp = ids_hash(p, q - p), w->a[w->n++].voff = voff;
+		}
+		p = q + 1;
+	}
+	return 0;
+}
+
+int vcf_ids_close_w(vcf_ids_writer_t *w)
+{
+	int fd, ret = 0;
+	int64_t i, j, n_bucket;
+	ids_hdr_t hdr;
+	uint64_t *bucket;
+	FILE *fp;
+	memset(&hdr, 0, sizeof(ids_hdr_t));
+	while (hdr.bits < 24 && (int64_t)1 << hdr.bits < w->n>>3) ++hdr.bits; // about 8 entries per bucket
+	n_bucket = (int64_t)1 << hdr.bits;
+	hdr.n = w->n;
+	qsort(w->a, w->n, sizeof(vcf_ids_entry_t), ids_cmp);
+	bucket = (uint64_t*)malloc((n_bucket + 1) * 8);
+	for (i = j = 0; i < n_bucket; ++i) {
+		bucket[i] = j;
+		while (j < w->n && (hdr.bits == 0? 0 : (int64_t)(w->a[j].fp >> (64 - hdr.bits))) == i) ++j;
+	}
+	bucket[n_bucket] = w->n;
+	if ((fd = vcf_sidecar_open_w(w->fn_bcf, ".ids", IDS_MAGIC)) < 0) ret = -1;
+	else {
+		if ((fp = fdopen(fd, "wb")) == 0) {
+			close(fd);
+			ret = -1;
+		} else {
+			fwrite(&hdr, sizeof(ids_hdr_t), 1, fp);
+			fwrite(bucket, 8, n_bucket + 1, fp);
+			fwrite(w->a, sizeof(vcf_ids_entry_t), w->n, fp);
+			if (ferror(fp)) ret = -1;
+			if (fclose(fp) != 0) ret = -1;
+		}
+		ret = vcf_sidecar_close_w(w->fn_bcf, ".ids", ret);
+	}
+	free(bucket);
+	free(w->a); free(w->str.s); free(w->fn_bcf);
+	free(w);
+	return ret;
+}
+
+int vcf_ids_build(const char *fn)
+{
+	vcfFile *in;
+	vcf_hdr_t *h;
+	vcf1_t *v;
+	vcf_ids_writer_t *w;
+	int64_t voff;
+	if ((in = vcf_open(fn, "rb", 0)) == 0) return -1;
+	h = vcf_hdr_read(in);
+	w = vcf_ids_open_w(fn);
+	v = vcf_init1();
+	for (;;) {
+		voff = vcf_tell(in);
+		if (vcf_read1(in, h, v) < 0) break;
+		vcf_ids_write1(w, v, voff);
+	}
+	vcf_destroy1(v);
+	vcf_hdr_destroy(h);
+	vcf_close(in);
+	return vcf_ids_close_w(w);
+}
+
+vcf_ids_t *vcf_ids_load(const char *fn)
+{
+	int fd;
+	struct stat st;
+	const ids_hdr_t *h;
+	vcf_ids_t *x;
+	void *map = MAP_FAILED;
+	uint64_t n_bucket = 0;
+	const size_t l_hdr = VCF_SIDECAR_HDR + sizeof(ids_hdr_t);
+	if ((fd = vcf_sidecar_open(fn, ".ids", IDS_MAGIC, "ID index")) < 0) return 0;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)l_hdr)
+		map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	h = map == MAP_FAILED? 0 : (const ids_hdr_t*)((const uint8_t*)map + VCF_SIDECAR_HDR);
+	if (h) n_bucket = (uint64_t)1 << (h->bits < 32? h->bits : 0);
+	if (h == 0 || h->bits > 24 || h->n > (uint64_t)st.st_size / sizeof(vcf_ids_entry_t)
+		|| l_hdr + (n_bucket + 1) * 8 + h->n * sizeof(vcf_ids_entry_t) != (uint64_t)st.st_size)
+	{
+		if (vcf_verbose >= 2)
+			fprintf(stderr, "[W::%s] the ID index of '%s' is corrupted; ignored\n", __func__, fn);
+		if (h) munmap(map, st.st_size);
+		return 0;
+	}
+	x = (vcf_ids_t*)calloc(1, sizeof(vcf_ids_t));
+	x->map = map, x->l_map = st.st_size;
+	x->bits = h->bits, x->n = h->n;
+	x->bucket = (const uint64_t*)((const uint8_t*)map + l_hdr);
+	x->a = (const vcf_ids_entry_t*)(x->bucket + n_bucket + 1);
+	return x;
+}
+
+void vcf_ids_destroy(vcf_ids_t *x)
+{
+	if (x == 0) return;
+	munmap(x->map, x->l_map);
+	free(x);
+}
+
+int vcf_ids_get(const vcf_ids_t *x, const char *id, int64_t **voff, int *m_voff)
+{
+	uint64_t fp, b;
+	int64_t lo, hi, i;
+	int n = 0;
+	fp = ids_hash(id, strlen(id));
+	b = x->bits? fp >> (64 - x->bits) : 0;
+	lo = x->bucket[b], hi = x->bucket[b+1];
+	if (lo > hi || hi > x->n) return 0;
+	while (lo < hi) { // the first entry not less than fp
+		int64_t mid = lo + ((hi - lo) >> 1);
+		if (x->a[mid].fp < fp) lo = mid + 1;
+		else hi = mid;
+	}
+	for (i = lo; i < x->n && x->a[i].fp == fp; ++i) {
+		if (n == *m_voff) {
+			*m_voff = *m_voff? *m_voff<<1 : 4;
+			*voff = (int64_t*)realloc(*voff, *m_voff * 8);
+		}
+		(*voff)[n++] = x->a[i].voff;
+	}
+	return n;
+}
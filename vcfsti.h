@@ -0,0 +1,146 @@
+#ifndef VCFSTI_H
+#define VCFSTI_H
+
+#include <stdint.h>
+#include "vcf.h"
+
+/* === Sites table ===
+
+   "in.bcf.sti" lists the sites of in.bcf in an uncompressed file that can
+   be mmapped and indexed directly:
+
+     header    56 bytes: that of vcf_sidecar_open() with "STI\3", then
+               n_sample, 4 unused bytes, n_site and the length of the heap
+     site      n_site vcf_site_t of 40 bytes, in the order of in.bcf
+     heap      for each site, the beginning of vcf1_t::shared up to INFO:
+               the typed ID, REF, ALT and FILTER
+
+   Each site keeps the virtual offset of its record, so that a scan over
+   sites can seek back into in.bcf for the full record. Integers are in
+   the host byte order.
+*/
+
+/* === ID index ===
+
+   "in.bcf.ids" maps the IDs of in.bcf, each of the ';'-separated values of
+   the ID column, to the virtual offsets of their records. It is a static
+   hash: 64-bit fingerprints of the IDs are sorted with their offsets, and
+   a directory of 2^bits buckets, over the top bits of the fingerprint,
+   narrows a lookup to a few entries. The file is mmapped:
+
+     header    48 bytes: that of vcf_sidecar_open() with "IDS\3", then
+               bits, 4 unused bytes and n
+     bucket    2^bits+1 uint64_t: the first entry of each bucket
+     entry     n pairs of uint64_t fingerprint and int64_t virtual offset
+
+   The IDs themselves are not stored; a hit must be confirmed against the
+   record.
+*/
+
+typedef struct {
+	int64_t voff; // virtual offset of the record in in.bcf
+	uint64_t off; // ID, REF, ALT and FILTER at heap + off
+	int32_t rid, pos, rlen;
+	float qual;
+	uint32_t n_allele, l_shared; // l_shared: length of the data in the heap
+} vcf_site_t;
+
+typedef struct {
+	int n_sample;
+	int64_t n_site;
+	uint64_t l_heap;
+	const vcf_site_t *a;
+	const uint8_t *heap;
+	void *map;
+	size_t l_map;
+} vcf_sti_t;
+
+typedef struct vcf_sti_writer_t vcf_sti_writer_t;
+
+typedef struct {
+	uint64_t fp;
+	int64_t voff;
+} vcf_ids_entry_t;
+
+typedef struct {
+	int bits;
+	int64_t n;
+	const uint64_t *bucket;
+	const vcf_ids_entry_t *a;
+	void *map;
+	size_t l_map;
+} vcf_ids_t;
+
+typedef struct vcf_ids_writer_t vcf_ids_writer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/** Start "fn.sti" for the BCF _fn_ being written with header _h_ */
+	vcf_sti_writer_t *vcf_sti_open_w(const char *fn, const vcf_hdr_t *h);
+
+	/**
+	 * Add a record.
+	 *
+	 * @param voff  vcf_tell() of the BCF just before the record is written
+	 */
+	int vcf_sti_write1(vcf_sti_writer_t *w, const vcf1_t *v, int64_t voff);
+
+	/**
+	 * Finish the table. Call after the BCF is closed; its key is recorded
+	 * to detect a stale table.
+	 *
+	 * @return 0 on success and -1 on I/O errors
+	 */
+	int vcf_sti_close_w(vcf_sti_writer_t *w);
+
+	/** Write "fn.sti" for an existing BCF _fn_; 0 on success and -1 on failure */
+	int vcf_sti_build(const char *fn);
+
+	/** mmap the sites table of BCF _fn_; 0 if absent, stale or malformed */
+	vcf_sti_t *vcf_sti_load(const char *fn);
+
+	void vcf_sti_destroy(vcf_sti_t *s);
+
+	/**
+	 * Fill _v_ with site _i_: CHROM, POS, QUAL, ID, REF, ALT and FILTER,
+	 * without INFO or samples.
+	 *
+	 * @return 0 on success and -1 if the site lies outside of the heap
+	 */
+	int vcf_sti_get(const vcf_sti_t *s, int64_t i, vcf1_t *v);
+
+	/** Start "fn.ids" for the BCF _fn_ being written */
+	vcf_ids_writer_t *vcf_ids_open_w(const char *fn);
+
+	/** Add the IDs of a record; see vcf_sti_write1() for _voff_ */
+	int vcf_ids_write1(vcf_ids_writer_t *w, const vcf1_t *v, int64_t voff);
+
+	/** Sort and write the index after the BCF is closed; 0 on success and -1 on I/O errors */
+	int vcf_ids_close_w(vcf_ids_writer_t *w);
+
+	/** Write "fn.ids" for an existing BCF _fn_; 0 on success and -1 on failure */
+	int vcf_ids_build(const char *fn);
+
+	/** mmap the ID index of BCF _fn_; 0 if absent, stale or malformed */
+	vcf_ids_t *vcf_ids_load(const char *fn);
+
+	void vcf_ids_destroy(vcf_ids_t *x);
+
+	/**
+	 * Get the virtual offsets of the records that may have ID _id_.
+	 *
+	 * Records of other IDs with the same fingerprint are included, so the
+	 * caller should check the ID of each record read.
+	 *
+	 * @param voff, m_voff  buffer and its capacity, reallocated if needed
+	 * @return number of offsets, in the order of the BCF
+	 */
+	int vcf_ids_get(const vcf_ids_t *x, const char *id, int64_t **voff, int *m_voff);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif